@@ -0,0 +1,20 @@
+#!/bin/sh
+# Prints the log of one package from an archive written with --log-archive,
+# e.g. ./contrib/log-lookup.sh ../createrepo_as_logs/fedora-21 gnome-software
+archive=$1
+name=$2
+if [ -z "$archive" ] || [ -z "$name" ]; then
+	echo "Usage: $0 LOG-DIR/BASENAME PACKAGE-NAME" >&2
+	exit 1
+fi
+
+# the last entry wins if the package was logged more than once
+entry=$(awk -F '\t' -v name="$name" \
+	'$1 == name { entry = $2 " " $3 } END { print entry }' \
+	"$archive.log.idx")
+if [ -z "$entry" ]; then
+	echo "No log for $name in $archive.log.idx" >&2
+	exit 1
+fi
+set -- $entry
+tail -c +$(($1 + 1)) "$archive.log.gz" | head -c "$2" | gzip -dc
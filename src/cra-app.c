@@ -22,10 +22,17 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <glib/gstdio.h>
 #include <appstream-glib.h>
 
 #include "cra-app.h"
 #include "cra-cleanup.h"
+#include "cra-executor.h"
+#include "cra-memory.h"
+#include "cra-metrics.h"
+#include "cra-pixels.h"
+#include "cra-probes.h"
+#include "cra-profile.h"
 
 typedef struct _CraAppPrivate	CraAppPrivate;
 struct _CraAppPrivate
@@ -99,9 +106,10 @@ cra_app_to_xml (CraApp *app)
 
 /**
  * cra_app_add_veto:
+ * @reason: a short fixed key for the metrics, e.g. "no-icon"
  **/
 void
-cra_app_add_veto (CraApp *app, const gchar *fmt, ...)
+cra_app_add_veto (CraApp *app, const gchar *reason, const gchar *fmt, ...)
 {
 	CraAppPrivate *priv = GET_PRIVATE (app);
 	gchar *tmp;
@@ -110,6 +118,7 @@ cra_app_add_veto (CraApp *app, const gchar *fmt, ...)
 	tmp = g_strdup_vprintf (fmt, args);
 	va_end (args);
 	g_ptr_array_add (priv->vetos, tmp);
+	cra_metrics_add (CRA_METRIC_VETOS, reason, 1);
 }
 
 /**
@@ -149,14 +158,27 @@ cra_app_set_pixbuf (CraApp *app, GdkPixbuf *pixbuf)
 {
 	CraAppPrivate *priv = GET_PRIVATE (app);
 	if (priv->pixbuf != NULL)
-		g_object_ref (priv->pixbuf);
+		g_object_unref (priv->pixbuf);
 	priv->pixbuf = g_object_ref (pixbuf);
+	cra_memory_add_pixbuf ("app-icon", pixbuf);
 
 	/* does the icon not have an alpha channel */
 	if (!gdk_pixbuf_get_has_alpha (priv->pixbuf)) {
 		cra_package_log (priv->pkg,
 				 CRA_PACKAGE_LOG_LEVEL_WARNING,
 				 "icon does not have an alpha channel");
+		return;
+	}
+
+	/* is the alpha channel unused, or is there nothing to see */
+	if (!cra_pixels_has_translucent (priv->pixbuf)) {
+		cra_package_log (priv->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "icon alpha channel is fully opaque");
+	} else if (cra_pixels_count_alpha (priv->pixbuf, 0) == 0) {
+		cra_package_log (priv->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "icon is fully transparent");
 	}
 }
 
@@ -190,6 +212,36 @@ cra_app_get_package (CraApp *app)
 	return priv->pkg;
 }
 
+/**
+ * cra_app_get_package_nevr:
+ *
+ * Returns the NEVR of the package the application came from, which is also
+ * known for applications loaded back from the output of a shard.
+ **/
+const gchar *
+cra_app_get_package_nevr (CraApp *app)
+{
+	CraAppPrivate *priv = GET_PRIVATE (app);
+	if (priv->pkg != NULL)
+		return cra_package_get_nevr (priv->pkg);
+	return as_app_get_metadata_item (AS_APP (app), "X-CreaterepoAsPackage");
+}
+
+/**
+ * cra_app_add_written_metric:
+ **/
+static void
+cra_app_add_written_metric (const gchar *kind, const gchar *filename)
+{
+	GStatBuf stat_buf;
+
+	if (!cra_metrics_enabled ())
+		return;
+	if (g_stat (filename, &stat_buf) != 0)
+		return;
+	cra_metrics_add (CRA_METRIC_WRITTEN_BYTES, kind, stat_buf.st_size);
+}
+
 /**
  * cra_app_save_resources_image:
  **/
@@ -234,6 +286,10 @@ cra_app_save_resources_image (CraApp *app,
 				      error);
 	if (!ret)
 		return FALSE;
+	CRA_PROBE3 (resource__saved,
+		    cra_package_get_name (cra_app_get_package (app)),
+		    "screenshot", filename);
+	cra_app_add_written_metric ("screenshot", filename);
 
 	/* set new AppStream compatible screenshot name */
 	cra_package_log (cra_app_get_package (app),
@@ -243,65 +299,130 @@ cra_app_save_resources_image (CraApp *app,
 
 }
 
+typedef struct {
+	CraApp		*app;
+	AsImage		*image;		/* or %NULL for the icon */
+	GError		*error;
+} CraAppSaveHelper;
+
 /**
- * cra_app_save_resources_screenshot:
+ * cra_app_save_resources_func:
  **/
-static gboolean
-cra_app_save_resources_screenshot (CraApp *app,
-				   AsScreenshot *screenshot,
-				   GError **error)
+static void
+cra_app_save_resources_func (gpointer data)
 {
-	AsImage *im;
-	GPtrArray *images;
-	guint i;
+	CraAppSaveHelper *helper = (CraAppSaveHelper *) data;
+	CraAppPrivate *priv = GET_PRIVATE (helper->app);
+	const gchar *tmpdir;
+	_cleanup_free_ gchar *filename = NULL;
 
-	images = as_screenshot_get_images (screenshot);
-	for (i = 0; i < images->len; i++) {
-		im = g_ptr_array_index (images, i);
-		if (!cra_app_save_resources_image (app, im, error))
-			return FALSE;
+	/* a screenshot */
+	if (helper->image != NULL) {
+		cra_app_save_resources_image (helper->app,
+					      helper->image,
+					      &helper->error);
+		return;
 	}
-	return TRUE;
+
+	/* the icon */
+	tmpdir = cra_package_get_config (priv->pkg, "TempDir");
+	filename = g_build_filename (tmpdir,
+				     "icons",
+				     as_app_get_icon (AS_APP (helper->app)),
+				     NULL);
+	if (!gdk_pixbuf_save (priv->pixbuf, filename, "png",
+			      &helper->error, NULL))
+		return;
+	CRA_PROBE3 (resource__saved,
+		    cra_package_get_name (priv->pkg),
+		    "icon", filename);
+	cra_app_add_written_metric ("icon", filename);
+
+	/* set new AppStream compatible icon name */
+	cra_package_log (priv->pkg,
+			 CRA_PACKAGE_LOG_LEVEL_DEBUG,
+			 "Saved icon %s", filename);
 }
 
 /**
  * cra_app_save_resources:
+ *
+ * The PNG encoding of each image is done as a separate job so that idle
+ * workers can help out with applications that have many screenshots.
  **/
 gboolean
 cra_app_save_resources (CraApp *app, GError **error)
 {
 	CraAppPrivate *priv = GET_PRIVATE (app);
+	CraAppSaveHelper *helper;
+	CraExecutorGroup *group;
 	AsScreenshot *ss;
-	guint i;
+	GPtrArray *images;
 	GPtrArray *screenshots;
+	gboolean ret = TRUE;
+	guint i;
+	guint j;
+	_cleanup_ptrarray_unref_ GPtrArray *helpers = NULL;
 
 	/* any non-stock icon set */
+	helpers = g_ptr_array_new_with_free_func (g_free);
 	if (priv->pixbuf != NULL) {
-		const gchar *tmpdir;
-		_cleanup_free_ gchar *filename = NULL;
-
-		tmpdir = cra_package_get_config (priv->pkg, "TempDir");
-		filename = g_build_filename (tmpdir,
-					     "icons",
-					     as_app_get_icon (AS_APP (app)),
-					     NULL);
-		if (!gdk_pixbuf_save (priv->pixbuf, filename, "png", error, NULL))
-			return FALSE;
-
-		/* set new AppStream compatible icon name */
-		cra_package_log (priv->pkg,
-				 CRA_PACKAGE_LOG_LEVEL_DEBUG,
-				 "Saved icon %s", filename);
+		helper = g_new0 (CraAppSaveHelper, 1);
+		helper->app = app;
+		g_ptr_array_add (helpers, helper);
 	}
 
 	/* save any screenshots */
 	screenshots = as_app_get_screenshots (AS_APP (app));
 	for (i = 0; i < screenshots->len; i++) {
 		ss = g_ptr_array_index (screenshots, i);
-		if (!cra_app_save_resources_screenshot (app, ss, error))
-			return FALSE;
+		images = as_screenshot_get_images (ss);
+		for (j = 0; j < images->len; j++) {
+			helper = g_new0 (CraAppSaveHelper, 1);
+			helper->app = app;
+			helper->image = g_ptr_array_index (images, j);
+			g_ptr_array_add (helpers, helper);
+		}
 	}
-	return TRUE;
+
+	/* encode them all, then report the first failure */
+	group = cra_executor_group_new (cra_executor_get_current ());
+	for (i = 0; i < helpers->len; i++)
+		cra_executor_group_push (group, cra_app_save_resources_func,
+					 g_ptr_array_index (helpers, i));
+	cra_executor_group_free (group);
+	for (i = 0; i < helpers->len; i++) {
+		helper = g_ptr_array_index (helpers, i);
+		if (helper->error == NULL)
+			continue;
+		if (ret) {
+			g_propagate_error (error, helper->error);
+			ret = FALSE;
+		} else {
+			g_error_free (helper->error);
+		}
+	}
+	return ret;
+}
+
+typedef struct {
+	AsImage		*im_src;
+	guint		 width;
+	guint		 height;
+	GdkPixbuf	*pixbuf;
+} CraAppResizeHelper;
+
+/**
+ * cra_app_resize_func:
+ **/
+static void
+cra_app_resize_func (gpointer data)
+{
+	CraAppResizeHelper *helper = (CraAppResizeHelper *) data;
+	helper->pixbuf = as_image_save_pixbuf (helper->im_src,
+					       helper->width,
+					       helper->height,
+					       AS_IMAGE_SAVE_FLAG_PAD_16_9);
 }
 
 /**
@@ -310,10 +431,17 @@ cra_app_save_resources (CraApp *app, GError **error)
 gboolean
 cra_app_add_screenshot_source (CraApp *app, const gchar *filename, GError **error)
 {
+	CraAppResizeHelper helpers[3];
+	CraExecutorGroup *group;
 	gboolean is_default;
+	gint64 profile;
 	guint sizes[] = { 624, 351, 112, 63, 752, 423, 0 };
 	const gchar *mirror_uri;
+	guint height;
 	guint i;
+	guint width;
+	guint x;
+	guint y;
 	_cleanup_free_ gchar *basename = NULL;
 	_cleanup_object_unref_ AsImage *im_src;
 	_cleanup_object_unref_ AsScreenshot *ss = NULL;
@@ -321,6 +449,7 @@ cra_app_add_screenshot_source (CraApp *app, const gchar *filename, GError **erro
 	im_src = as_image_new ();
 	if (!as_image_load_filename (im_src, filename, error))
 		return FALSE;
+	cra_memory_add_pixbuf ("screenshot-source", as_image_get_pixbuf (im_src));
 
 	/* is the aspect ratio of the source perfectly 16:9 */
 	if ((as_image_get_width (im_src) / 16) * 9 !=
@@ -331,6 +460,18 @@ cra_app_add_screenshot_source (CraApp *app, const gchar *filename, GError **erro
 				 filename);
 	}
 
+	/* padding would be added around the padding already there */
+	if (cra_pixels_get_bounds (as_image_get_pixbuf (im_src),
+				   &x, &y, &width, &height) &&
+	    (width != as_image_get_width (im_src) ||
+	     height != as_image_get_height (im_src))) {
+		cra_package_log (cra_app_get_package (app),
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "%s has transparent padding around the "
+				 "%ux%u content at %u,%u",
+				 filename, width, height, x, y);
+	}
+
 	ss = as_screenshot_new ();
 	is_default = as_app_get_screenshots(AS_APP(app))->len == 0;
 	as_screenshot_set_kind (ss, is_default ? AS_SCREENSHOT_KIND_DEFAULT :
@@ -354,6 +495,20 @@ cra_app_add_screenshot_source (CraApp *app, const gchar *filename, GError **erro
 		as_image_set_kind (im_src, AS_IMAGE_KIND_SOURCE);
 		as_screenshot_add_image (ss, im_src);
 	} else {
+		/* resize to each size in parallel */
+		profile = cra_profile_start ();
+		group = cra_executor_group_new (cra_executor_get_current ());
+		for (i = 0; sizes[i] != 0; i += 2) {
+			helpers[i / 2].im_src = im_src;
+			helpers[i / 2].width = sizes[i];
+			helpers[i / 2].height = sizes[i+1];
+			cra_executor_group_push (group, cra_app_resize_func,
+						 &helpers[i / 2]);
+		}
+		cra_executor_group_free (group);
+		cra_profile_stop (profile, cra_app_get_package (app),
+				  "screenshot-resize", NULL);
+
 		for (i = 0; sizes[i] != 0; i += 2) {
 			_cleanup_free_ gchar *size_str;
 			_cleanup_free_ gchar *url_tmp;
@@ -367,10 +522,8 @@ cra_app_add_screenshot_source (CraApp *app, const gchar *filename, GError **erro
 						    size_str,
 						    basename,
 						    NULL);
-			pixbuf = as_image_save_pixbuf (im_src,
-						       sizes[i],
-						       sizes[i+1],
-						       AS_IMAGE_SAVE_FLAG_PAD_16_9);
+			pixbuf = helpers[i / 2].pixbuf;
+			cra_memory_add_pixbuf ("screenshot-thumbnail", pixbuf);
 			im_tmp = as_image_new ();
 			as_image_set_width (im_tmp, sizes[i]);
 			as_image_set_height (im_tmp, sizes[i+1]);
@@ -58,9 +58,10 @@ CraApp		*cra_app_new			(CraPackage	*pkg,
 						 const gchar	*id_full);
 gchar		*cra_app_to_xml			(CraApp		*app);
 void		 cra_app_add_veto		(CraApp		*app,
+						 const gchar	*reason,
 						 const gchar	*fmt,
 						 ...)
-						 G_GNUC_PRINTF(2,3);
+						 G_GNUC_PRINTF(3,4);
 void		 cra_app_add_requires_appdata	(CraApp		*app,
 						 const gchar	*fmt,
 						 ...)
@@ -76,6 +77,7 @@ gboolean	 cra_app_add_screenshot_source	(CraApp		*app,
 GPtrArray	*cra_app_get_requires_appdata	(CraApp		*app);
 GPtrArray	*cra_app_get_vetos		(CraApp		*app);
 CraPackage	*cra_app_get_package		(CraApp		*app);
+const gchar	*cra_app_get_package_nevr	(CraApp		*app);
 
 gboolean	 cra_app_save_resources		(CraApp		*app,
 						 GError		**error);
@@ -63,13 +63,14 @@ cra_context_add_blacklist_pkg (CraContext *ctx, const gchar *pkg)
 
 /**
  * cra_context_add_app:
+ *
+ * This is not locked; tasks collect their own results which are only added
+ * from the main thread when all the workers have finished.
  */
 void
 cra_context_add_app (CraContext *ctx, CraApp *app)
 {
-	g_mutex_lock (&ctx->apps_mutex);
-	cra_plugin_add_app (&ctx->apps, app);
-	g_mutex_unlock (&ctx->apps_mutex);
+	cra_store_add_app (ctx->store, AS_APP (app));
 }
 
 /**
@@ -84,8 +85,8 @@ cra_context_new (void)
 	ctx->plugins = cra_plugin_loader_new ();
 	ctx->packages = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	ctx->extra_pkgs = cra_glob_value_array_new ();
-	g_mutex_init (&ctx->apps_mutex);
 	ctx->old_md_cache = as_store_new ();
+	ctx->store = cra_store_new ();
 
 	/* add extra data */
 	cra_context_add_extra_pkg (ctx, "alliance-libs", "alliance");
@@ -128,13 +129,25 @@ void
 cra_context_free (CraContext *ctx)
 {
 	g_object_unref (ctx->old_md_cache);
+	if (ctx->executor != NULL)
+		cra_executor_free (ctx->executor);
+	if (ctx->governor != NULL)
+		cra_governor_free (ctx->governor);
+	if (ctx->worker_governor != NULL)
+		cra_governor_free (ctx->worker_governor);
+	if (ctx->journal != NULL)
+		cra_journal_free (ctx->journal);
+	if (ctx->watchdog != NULL)
+		cra_watchdog_free (ctx->watchdog);
+	if (ctx->progress != NULL)
+		cra_progress_free (ctx->progress);
+	if (ctx->log_sink != NULL)
+		cra_log_sink_free (ctx->log_sink);
 	cra_plugin_loader_free (ctx->plugins);
 	g_ptr_array_unref (ctx->packages);
 	g_ptr_array_unref (ctx->extra_pkgs);
-	g_list_foreach (ctx->apps, (GFunc) g_object_unref, NULL);
-	g_list_free (ctx->apps);
+	cra_store_free (ctx->store);
 	g_ptr_array_unref (ctx->blacklisted_pkgs);
 	g_ptr_array_unref (ctx->file_globs);
-	g_mutex_clear (&ctx->apps_mutex);
 	g_free (ctx);
 }
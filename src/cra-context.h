@@ -26,7 +26,14 @@
 #include <appstream-glib.h>
 
 #include "cra-app.h"
+#include "cra-executor.h"
+#include "cra-governor.h"
+#include "cra-journal.h"
+#include "cra-log-sink.h"
 #include "cra-package.h"
+#include "cra-progress.h"
+#include "cra-store.h"
+#include "cra-watchdog.h"
 
 G_BEGIN_DECLS
 
@@ -36,13 +43,22 @@ typedef struct {
 	GPtrArray	*plugins;		/* of CraPlugin */
 	GPtrArray	*packages;		/* of CraPackage */
 	GPtrArray	*file_globs;		/* of CraPackage */
-	GList		*apps;			/* of CraApp */
-	GMutex		 apps_mutex;		/* for ->apps */
+	CraStore	*store;			/* of AsApp and CraApp */
+	CraExecutor	*executor;
+	CraGovernor	*governor;
+	CraGovernor	*worker_governor;	/* only in the coordinator */
+	CraJournal	*journal;
+	CraLogSink	*log_sink;
+	CraProgress	*progress;
+	CraWatchdog	*watchdog;
 	gboolean	 no_net;
 	gdouble		 api_version;
 	gboolean	 add_cache_id;
 	gboolean	 extra_checks;
+	gboolean	 log_xml;
 	gboolean	 use_package_cache;
+	guint		 shard_id;		/* from 1 */
+	guint		 shard_nr;		/* or 0 for all packages */
 	AsStore		*old_md_cache;
 } CraContext;
 
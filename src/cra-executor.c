@@ -0,0 +1,453 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "cra-cleanup.h"
+#include "cra-executor.h"
+#include "cra-metrics.h"
+
+typedef struct {
+	CraExecutorFunc		 func;
+	gpointer		 data;
+	CraExecutorGroup	*group;
+} CraExecutorJob;
+
+typedef struct {
+	CraExecutor	*executor;
+	GThread		*thread;
+	GQueue		 deque;		/* of CraExecutorJob */
+	GMutex		 mutex;		/* for ->deque and ->max_depth */
+	guint		 id;
+	guint		 nr_jobs;
+	guint		 nr_steals;
+	guint		 max_depth;
+} CraExecutorWorker;
+
+struct CraExecutor {
+	CraExecutorWorker	*workers;
+	guint			 nr_workers;
+	GQueue			 queue;		/* of CraExecutorJob */
+	guint			 queue_max_depth;
+	GMutex			 mutex;		/* for ->queue and ->shutdown */
+	GCond			 cond;		/* work queued or shutdown */
+	GCond			 idle_cond;	/* nothing left pending */
+	gint			 nr_queued;	/* in any queue */
+	gint			 nr_pending;	/* queued or running */
+	gboolean		 shutdown;
+};
+
+struct CraExecutorGroup {
+	CraExecutor	*executor;
+	guint		 pending;
+	GMutex		 mutex;		/* for ->pending */
+	GCond		 cond;
+};
+
+/* the worker the current thread is, if any */
+static GPrivate cra_executor_current = G_PRIVATE_INIT (NULL);
+
+/**
+ * cra_executor_find_job:
+ *
+ * Workers run the newest job from their own deque first, as these are the
+ * children of the task they were last running, then steal the oldest job
+ * from another worker, and only then start something new from the queue.
+ */
+static CraExecutorJob *
+cra_executor_find_job (CraExecutor *executor,
+		       CraExecutorWorker *self,
+		       gboolean use_queue)
+{
+	CraExecutorJob *job = NULL;
+	CraExecutorWorker *victim;
+	guint i;
+	guint start = 0;
+
+	/* our own */
+	if (self != NULL) {
+		g_mutex_lock (&self->mutex);
+		job = g_queue_pop_tail (&self->deque);
+		g_mutex_unlock (&self->mutex);
+		if (job != NULL)
+			goto out;
+		start = self->id + 1;
+	}
+
+	/* steal */
+	for (i = 0; i < executor->nr_workers; i++) {
+		victim = &executor->workers[(start + i) % executor->nr_workers];
+		if (victim == self)
+			continue;
+		g_mutex_lock (&victim->mutex);
+		job = g_queue_pop_head (&victim->deque);
+		g_mutex_unlock (&victim->mutex);
+		if (job != NULL) {
+			if (self != NULL)
+				self->nr_steals++;
+			goto out;
+		}
+	}
+
+	/* something new */
+	if (use_queue) {
+		g_mutex_lock (&executor->mutex);
+		job = g_queue_pop_head (&executor->queue);
+		g_mutex_unlock (&executor->mutex);
+	}
+out:
+	if (job != NULL) {
+		g_atomic_int_add (&executor->nr_queued, -1);
+		cra_metrics_set_count (CRA_METRIC_QUEUE_DEPTH,
+				       g_atomic_int_get (&executor->nr_queued));
+	}
+	return job;
+}
+
+/**
+ * cra_executor_run_job:
+ */
+static void
+cra_executor_run_job (CraExecutor *executor, CraExecutorJob *job)
+{
+	CraExecutorGroup *group = job->group;
+
+	job->func (job->data);
+	g_slice_free (CraExecutorJob, job);
+
+	/* wake up the parent, which may also want to help with what is left */
+	if (group != NULL) {
+		g_mutex_lock (&group->mutex);
+		group->pending--;
+		g_cond_broadcast (&group->cond);
+		g_mutex_unlock (&group->mutex);
+	}
+
+	/* wake up anything waiting for the executor to be idle */
+	if (g_atomic_int_dec_and_test (&executor->nr_pending)) {
+		g_mutex_lock (&executor->mutex);
+		g_cond_broadcast (&executor->idle_cond);
+		g_mutex_unlock (&executor->mutex);
+	}
+}
+
+/**
+ * cra_executor_worker_func:
+ */
+static gpointer
+cra_executor_worker_func (gpointer data)
+{
+	CraExecutorJob *job;
+	CraExecutorWorker *self = (CraExecutorWorker *) data;
+	CraExecutor *executor = self->executor;
+
+	g_private_set (&cra_executor_current, self);
+	while (TRUE) {
+		job = cra_executor_find_job (executor, self, TRUE);
+		if (job != NULL) {
+			self->nr_jobs++;
+			cra_executor_run_job (executor, job);
+			continue;
+		}
+
+		/* sleep until there is something to do */
+		g_mutex_lock (&executor->mutex);
+		while (g_atomic_int_get (&executor->nr_queued) == 0 &&
+		       !executor->shutdown)
+			g_cond_wait (&executor->cond, &executor->mutex);
+		if (executor->shutdown &&
+		    g_atomic_int_get (&executor->nr_queued) == 0) {
+			g_mutex_unlock (&executor->mutex);
+			break;
+		}
+		g_mutex_unlock (&executor->mutex);
+	}
+	return NULL;
+}
+
+/**
+ * cra_executor_push_job:
+ */
+static void
+cra_executor_push_job (CraExecutor *executor, CraExecutorJob *job)
+{
+	CraExecutorWorker *self;
+
+	g_atomic_int_inc (&executor->nr_pending);
+
+	/* counted under the lock the job is pushed with, so a thief can never
+	 * take it before it is counted, nor see a count with nothing there */
+	self = g_private_get (&cra_executor_current);
+	if (self != NULL && self->executor == executor) {
+		g_mutex_lock (&self->mutex);
+		g_queue_push_tail (&self->deque, job);
+		g_atomic_int_inc (&executor->nr_queued);
+		self->max_depth = MAX (self->max_depth, self->deque.length);
+		g_mutex_unlock (&self->mutex);
+	} else {
+		g_mutex_lock (&executor->mutex);
+		g_queue_push_tail (&executor->queue, job);
+		g_atomic_int_inc (&executor->nr_queued);
+		executor->queue_max_depth = MAX (executor->queue_max_depth,
+						 executor->queue.length);
+		g_mutex_unlock (&executor->mutex);
+	}
+	cra_metrics_set_count (CRA_METRIC_QUEUE_DEPTH,
+			       g_atomic_int_get (&executor->nr_queued));
+
+	/* wake up a sleeping worker */
+	g_mutex_lock (&executor->mutex);
+	g_cond_signal (&executor->cond);
+	g_mutex_unlock (&executor->mutex);
+}
+
+/**
+ * cra_executor_push:
+ */
+void
+cra_executor_push (CraExecutor *executor, CraExecutorFunc func, gpointer data)
+{
+	CraExecutorJob *job;
+	job = g_slice_new0 (CraExecutorJob);
+	job->func = func;
+	job->data = data;
+	cra_executor_push_job (executor, job);
+}
+
+/**
+ * cra_executor_wait:
+ *
+ * Waits for all the jobs to finish, including any children they create.
+ * This must not be called from a job.
+ */
+void
+cra_executor_wait (CraExecutor *executor)
+{
+	g_mutex_lock (&executor->mutex);
+	while (g_atomic_int_get (&executor->nr_pending) > 0)
+		g_cond_wait (&executor->idle_cond, &executor->mutex);
+	g_mutex_unlock (&executor->mutex);
+}
+
+/**
+ * cra_executor_get_current:
+ *
+ * Returns the executor running the current job, or %NULL if the calling
+ * thread is not a worker.
+ */
+CraExecutor *
+cra_executor_get_current (void)
+{
+	CraExecutorWorker *self;
+	self = g_private_get (&cra_executor_current);
+	if (self == NULL)
+		return NULL;
+	return self->executor;
+}
+
+/**
+ * cra_executor_print_stats:
+ */
+void
+cra_executor_print_stats (CraExecutor *executor)
+{
+	CraExecutorWorker *worker;
+	guint i;
+
+	g_debug ("executor queue max depth %u", executor->queue_max_depth);
+	for (i = 0; i < executor->nr_workers; i++) {
+		worker = &executor->workers[i];
+		g_debug ("worker %u ran %u jobs, stole %u, max depth %u",
+			 worker->id, worker->nr_jobs,
+			 worker->nr_steals, worker->max_depth);
+	}
+}
+
+/**
+ * cra_executor_new:
+ */
+CraExecutor *
+cra_executor_new (guint nr_workers, GError **error)
+{
+	CraExecutor *executor;
+	CraExecutorWorker *worker;
+	guint i;
+
+	executor = g_new0 (CraExecutor, 1);
+	executor->nr_workers = MAX (nr_workers, 1);
+	executor->workers = g_new0 (CraExecutorWorker, executor->nr_workers);
+	g_queue_init (&executor->queue);
+	g_mutex_init (&executor->mutex);
+	g_cond_init (&executor->cond);
+	g_cond_init (&executor->idle_cond);
+	for (i = 0; i < executor->nr_workers; i++) {
+		worker = &executor->workers[i];
+		worker->executor = executor;
+		worker->id = i;
+		g_queue_init (&worker->deque);
+		g_mutex_init (&worker->mutex);
+	}
+
+	/* only start the threads when all the workers can be stolen from */
+	for (i = 0; i < executor->nr_workers; i++) {
+		_cleanup_free_ gchar *name = NULL;
+		worker = &executor->workers[i];
+		name = g_strdup_printf ("cra-worker-%u", i);
+		worker->thread = g_thread_try_new (name,
+						   cra_executor_worker_func,
+						   worker,
+						   error);
+		if (worker->thread == NULL) {
+			cra_executor_free (executor);
+			return NULL;
+		}
+	}
+	return executor;
+}
+
+/**
+ * cra_executor_free:
+ *
+ * Waits for all the jobs to finish, then stops the workers.
+ */
+void
+cra_executor_free (CraExecutor *executor)
+{
+	CraExecutorWorker *worker;
+	guint i;
+
+	cra_executor_wait (executor);
+	g_mutex_lock (&executor->mutex);
+	executor->shutdown = TRUE;
+	g_cond_broadcast (&executor->cond);
+	g_mutex_unlock (&executor->mutex);
+	for (i = 0; i < executor->nr_workers; i++) {
+		worker = &executor->workers[i];
+		if (worker->thread != NULL)
+			g_thread_join (worker->thread);
+		g_mutex_clear (&worker->mutex);
+	}
+	g_mutex_clear (&executor->mutex);
+	g_cond_clear (&executor->cond);
+	g_cond_clear (&executor->idle_cond);
+	g_free (executor->workers);
+	g_free (executor);
+}
+
+/**
+ * cra_executor_group_new:
+ *
+ * Creates a group of child jobs that can be waited for. If @executor is %NULL
+ * the jobs are run as soon as they are pushed.
+ */
+CraExecutorGroup *
+cra_executor_group_new (CraExecutor *executor)
+{
+	CraExecutorGroup *group;
+	group = g_new0 (CraExecutorGroup, 1);
+	group->executor = executor;
+	g_mutex_init (&group->mutex);
+	g_cond_init (&group->cond);
+	return group;
+}
+
+/**
+ * cra_executor_group_free:
+ */
+void
+cra_executor_group_free (CraExecutorGroup *group)
+{
+	cra_executor_group_wait (group);
+	g_mutex_clear (&group->mutex);
+	g_cond_clear (&group->cond);
+	g_free (group);
+}
+
+/**
+ * cra_executor_group_push:
+ */
+void
+cra_executor_group_push (CraExecutorGroup *group,
+			 CraExecutorFunc func,
+			 gpointer data)
+{
+	CraExecutorJob *job;
+
+	/* no executor, so just do it now */
+	if (group->executor == NULL) {
+		func (data);
+		return;
+	}
+
+	g_mutex_lock (&group->mutex);
+	group->pending++;
+	g_mutex_unlock (&group->mutex);
+	job = g_slice_new0 (CraExecutorJob);
+	job->func = func;
+	job->data = data;
+	job->group = group;
+	cra_executor_push_job (group->executor, job);
+}
+
+/**
+ * cra_executor_group_wait:
+ *
+ * Waits for all the jobs in the group to finish. Rather than blocking the
+ * worker, the caller runs its own children and steals work from the other
+ * workers until there is nothing left but jobs already running elsewhere.
+ */
+void
+cra_executor_group_wait (CraExecutorGroup *group)
+{
+	CraExecutorJob *job;
+	CraExecutorWorker *self;
+	guint pending;
+
+	if (group->executor == NULL)
+		return;
+	self = g_private_get (&cra_executor_current);
+	if (self != NULL && self->executor != group->executor)
+		self = NULL;
+	while (TRUE) {
+		g_mutex_lock (&group->mutex);
+		if (group->pending == 0) {
+			g_mutex_unlock (&group->mutex);
+			break;
+		}
+		g_mutex_unlock (&group->mutex);
+
+		/* help out, but never start a whole new task */
+		job = cra_executor_find_job (group->executor, self, FALSE);
+		if (job != NULL) {
+			if (self != NULL)
+				self->nr_jobs++;
+			cra_executor_run_job (group->executor, job);
+			continue;
+		}
+
+		/* the rest are running elsewhere; sleep until one finishes */
+		g_mutex_lock (&group->mutex);
+		pending = group->pending;
+		while (group->pending > 0 && group->pending == pending)
+			g_cond_wait (&group->cond, &group->mutex);
+		g_mutex_unlock (&group->mutex);
+	}
+}
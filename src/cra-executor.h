@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_EXECUTOR_H
+#define __CRA_EXECUTOR_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct	CraExecutor		CraExecutor;
+typedef struct	CraExecutorGroup	CraExecutorGroup;
+
+typedef void		 (*CraExecutorFunc)		(gpointer	 data);
+
+CraExecutor	*cra_executor_new			(guint		 nr_workers,
+							 GError		**error);
+void		 cra_executor_free			(CraExecutor	*executor);
+void		 cra_executor_push			(CraExecutor	*executor,
+							 CraExecutorFunc func,
+							 gpointer	 data);
+void		 cra_executor_wait			(CraExecutor	*executor);
+void		 cra_executor_print_stats		(CraExecutor	*executor);
+CraExecutor	*cra_executor_get_current		(void);
+
+CraExecutorGroup *cra_executor_group_new		(CraExecutor	*executor);
+void		 cra_executor_group_free		(CraExecutorGroup *group);
+void		 cra_executor_group_push		(CraExecutorGroup *group,
+							 CraExecutorFunc func,
+							 gpointer	 data);
+void		 cra_executor_group_wait		(CraExecutorGroup *group);
+
+G_END_DECLS
+
+#endif /* __CRA_EXECUTOR_H */
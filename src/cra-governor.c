@@ -0,0 +1,139 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "cra-governor.h"
+
+struct CraGovernor {
+	guint64		 disk_budget;		/* or 0 for unlimited */
+	guint64		 memory_budget;		/* or 0 for unlimited */
+	guint64		 disk_used;
+	guint64		 memory_used;
+	GMutex		 mutex;			/* for ->*_used */
+	GCond		 cond;
+};
+
+/**
+ * cra_governor_new:
+ */
+CraGovernor *
+cra_governor_new (guint64 disk_budget, guint64 memory_budget)
+{
+	CraGovernor *governor;
+	governor = g_new0 (CraGovernor, 1);
+	governor->disk_budget = disk_budget;
+	governor->memory_budget = memory_budget;
+	g_mutex_init (&governor->mutex);
+	g_cond_init (&governor->cond);
+	return governor;
+}
+
+/**
+ * cra_governor_free:
+ */
+void
+cra_governor_free (CraGovernor *governor)
+{
+	g_mutex_clear (&governor->mutex);
+	g_cond_clear (&governor->cond);
+	g_free (governor);
+}
+
+/**
+ * cra_governor_can_admit:
+ */
+static gboolean
+cra_governor_can_admit (CraGovernor *governor, guint64 disk, guint64 memory)
+{
+	/* always let one thing through, even if it is over budget */
+	if (governor->disk_used == 0 && governor->memory_used == 0)
+		return TRUE;
+	if (governor->disk_budget > 0 &&
+	    governor->disk_used + disk > governor->disk_budget)
+		return FALSE;
+	if (governor->memory_budget > 0 &&
+	    governor->memory_used + memory > governor->memory_budget)
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * cra_governor_reserve:
+ *
+ * Blocks until @disk bytes of temporary space and @memory bytes of memory
+ * can be used without going over budget, then reserves them.
+ *
+ * Returns: %TRUE if the caller had to wait
+ */
+gboolean
+cra_governor_reserve (CraGovernor *governor, guint64 disk, guint64 memory)
+{
+	gboolean waited = FALSE;
+
+	g_mutex_lock (&governor->mutex);
+	while (!cra_governor_can_admit (governor, disk, memory)) {
+		g_cond_wait (&governor->cond, &governor->mutex);
+		waited = TRUE;
+	}
+	governor->disk_used += disk;
+	governor->memory_used += memory;
+	g_mutex_unlock (&governor->mutex);
+	return waited;
+}
+
+/**
+ * cra_governor_try_reserve:
+ *
+ * Reserves @disk bytes of temporary space and @memory bytes of memory if
+ * that does not go over budget, without blocking.
+ *
+ * Returns: %TRUE if they were reserved
+ */
+gboolean
+cra_governor_try_reserve (CraGovernor *governor, guint64 disk, guint64 memory)
+{
+	gboolean ret;
+
+	g_mutex_lock (&governor->mutex);
+	ret = cra_governor_can_admit (governor, disk, memory);
+	if (ret) {
+		governor->disk_used += disk;
+		governor->memory_used += memory;
+	}
+	g_mutex_unlock (&governor->mutex);
+	return ret;
+}
+
+/**
+ * cra_governor_release:
+ */
+void
+cra_governor_release (CraGovernor *governor, guint64 disk, guint64 memory)
+{
+	if (disk == 0 && memory == 0)
+		return;
+	g_mutex_lock (&governor->mutex);
+	governor->disk_used -= MIN (disk, governor->disk_used);
+	governor->memory_used -= MIN (memory, governor->memory_used);
+	g_cond_broadcast (&governor->cond);
+	g_mutex_unlock (&governor->mutex);
+}
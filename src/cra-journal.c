@@ -0,0 +1,301 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cra-cleanup.h"
+#include "cra-journal.h"
+#include "cra-plugin.h"
+
+/* cache-id, component XML and the name and data of each icon */
+#define CRA_JOURNAL_ENTRY_TYPE		"(ssa(say))"
+
+struct CraJournal {
+	gint		 fd;
+	GHashTable	*entries;	/* of cache-id : GVariant */
+	GMutex		 mutex;		/* for ->fd */
+};
+
+/**
+ * cra_journal_write_all:
+ */
+static gboolean
+cra_journal_write_all (gint fd, gconstpointer data, gsize len)
+{
+	const guint8 *tmp = data;
+	gssize wrote;
+
+	while (len > 0) {
+		wrote = write (fd, tmp, len);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0)
+			return FALSE;
+		tmp += wrote;
+		len -= wrote;
+	}
+	return TRUE;
+}
+
+/**
+ * cra_journal_load:
+ *
+ * Each entry is a 32 bit length followed by a serialized GVariant. Anything
+ * after the last complete entry was being written when the run was killed,
+ * so the file is truncated to the last complete entry.
+ */
+static gboolean
+cra_journal_load (CraJournal *journal, const gchar *filename, GError **error)
+{
+	GBytes *bytes;
+	GVariant *entry;
+	const gchar *cache_id;
+	gsize len = 0;
+	gsize offset = 0;
+	guint32 entry_len;
+	_cleanup_free_ gchar *data = NULL;
+
+	if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+		return TRUE;
+	if (!g_file_get_contents (filename, &data, &len, error))
+		return FALSE;
+	while (offset + sizeof (entry_len) <= len) {
+		memcpy (&entry_len, data + offset, sizeof (entry_len));
+		if (offset + sizeof (entry_len) + entry_len > len)
+			break;
+		bytes = g_bytes_new (data + offset + sizeof (entry_len),
+				     entry_len);
+		entry = g_variant_new_from_bytes (G_VARIANT_TYPE (CRA_JOURNAL_ENTRY_TYPE),
+						  bytes, FALSE);
+		g_bytes_unref (bytes);
+		if (!g_variant_is_normal_form (entry)) {
+			g_variant_unref (entry);
+			break;
+		}
+		g_variant_get_child (entry, 0, "&s", &cache_id);
+		g_hash_table_insert (journal->entries,
+				     g_strdup (cache_id),
+				     g_variant_ref_sink (entry));
+		offset += sizeof (entry_len) + entry_len;
+	}
+	if (offset < len) {
+		g_warning ("ignoring %" G_GSIZE_FORMAT " bytes of incomplete journal",
+			   len - offset);
+		if (truncate (filename, offset) != 0) {
+			g_set_error (error,
+				     CRA_PLUGIN_ERROR,
+				     CRA_PLUGIN_ERROR_FAILED,
+				     "Failed to truncate %s: %s",
+				     filename, g_strerror (errno));
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * cra_journal_open:
+ *
+ * Opens the journal, discarding any existing entries unless @resume is set.
+ */
+CraJournal *
+cra_journal_open (const gchar *filename, gboolean resume, GError **error)
+{
+	CraJournal *journal;
+	gint flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+
+	journal = g_new0 (CraJournal, 1);
+	journal->fd = -1;
+	journal->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, (GDestroyNotify) g_variant_unref);
+	g_mutex_init (&journal->mutex);
+	if (resume) {
+		if (!cra_journal_load (journal, filename, error)) {
+			cra_journal_free (journal);
+			return NULL;
+		}
+	} else {
+		flags |= O_TRUNC;
+	}
+	journal->fd = g_open (filename, flags, 0644);
+	if (journal->fd < 0) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to open %s: %s",
+			     filename, g_strerror (errno));
+		cra_journal_free (journal);
+		return NULL;
+	}
+	return journal;
+}
+
+/**
+ * cra_journal_free:
+ */
+void
+cra_journal_free (CraJournal *journal)
+{
+	if (journal->fd >= 0)
+		close (journal->fd);
+	g_hash_table_unref (journal->entries);
+	g_mutex_clear (&journal->mutex);
+	g_free (journal);
+}
+
+/**
+ * cra_journal_add:
+ *
+ * Appends the results of one package to the journal, along with the contents
+ * of each of @icons in @icons_dir. This is safe to call from any thread, and
+ * the entry is synced to disk before returning.
+ */
+gboolean
+cra_journal_add (CraJournal *journal,
+		 const gchar *cache_id,
+		 const gchar *xml,
+		 const gchar *icons_dir,
+		 GPtrArray *icons,
+		 GError **error)
+{
+	GVariantBuilder builder;
+	const gchar *icon;
+	gboolean ret = TRUE;
+	gsize len;
+	off_t offset;
+	guint32 entry_len;
+	guint i;
+	_cleanup_variant_unref_ GVariant *entry = NULL;
+
+	/* add the icons too, as the temp dir may not survive */
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(say)"));
+	for (i = 0; i < icons->len; i++) {
+		_cleanup_free_ gchar *data = NULL;
+		_cleanup_free_ gchar *filename = NULL;
+		icon = g_ptr_array_index (icons, i);
+		filename = g_build_filename (icons_dir, icon, NULL);
+		if (!g_file_get_contents (filename, &data, &len, error)) {
+			g_variant_builder_clear (&builder);
+			return FALSE;
+		}
+		g_variant_builder_add (&builder, "(s@ay)", icon,
+				       g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+								  data, len, 1));
+	}
+	entry = g_variant_ref_sink (g_variant_new ("(ssa(say))",
+						   cache_id, xml, &builder));
+
+	/* write the length and the entry together */
+	entry_len = g_variant_get_size (entry);
+	g_mutex_lock (&journal->mutex);
+	offset = lseek (journal->fd, 0, SEEK_END);
+	if (offset < 0) {
+		ret = FALSE;
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to seek journal: %s",
+			     g_strerror (errno));
+		goto out;
+	}
+	if (!cra_journal_write_all (journal->fd, &entry_len, sizeof (entry_len)) ||
+	    !cra_journal_write_all (journal->fd,
+				    g_variant_get_data (entry),
+				    entry_len)) {
+		ret = FALSE;
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to write journal: %s",
+			     g_strerror (errno));
+
+		/* don't leave a partial entry for the next to follow */
+		if (ftruncate (journal->fd, offset) != 0)
+			g_warning ("failed to truncate journal: %s",
+				   g_strerror (errno));
+		goto out;
+	}
+	if (fdatasync (journal->fd) != 0) {
+		ret = FALSE;
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to sync journal: %s",
+			     g_strerror (errno));
+		goto out;
+	}
+out:
+	g_mutex_unlock (&journal->mutex);
+	return ret;
+}
+
+/**
+ * cra_journal_contains:
+ */
+gboolean
+cra_journal_contains (CraJournal *journal, const gchar *cache_id)
+{
+	return g_hash_table_contains (journal->entries, cache_id);
+}
+
+/**
+ * cra_journal_restore:
+ *
+ * Writes any icons for the package back to @icons_dir and returns the
+ * component XML. The package has to be in the journal.
+ */
+gboolean
+cra_journal_restore (CraJournal *journal,
+		     const gchar *cache_id,
+		     const gchar *icons_dir,
+		     gchar **xml,
+		     GError **error)
+{
+	GVariant *entry;
+	GVariantIter *iter;
+	const gchar *icon;
+	gconstpointer data;
+	gsize len;
+	_cleanup_variant_unref_ GVariant *icon_data = NULL;
+
+	entry = g_hash_table_lookup (journal->entries, cache_id);
+	g_variant_get (entry, "(&s&sa(s@ay))", NULL, NULL, &iter);
+	while (g_variant_iter_next (iter, "(&s@ay)", &icon, &icon_data)) {
+		_cleanup_free_ gchar *filename = NULL;
+		filename = g_build_filename (icons_dir, icon, NULL);
+		data = g_variant_get_fixed_array (icon_data, &len, 1);
+		if (!g_file_set_contents (filename, data, len, error)) {
+			g_variant_iter_free (iter);
+			return FALSE;
+		}
+		g_variant_unref (icon_data);
+		icon_data = NULL;
+	}
+	g_variant_iter_free (iter);
+	g_variant_get_child (entry, 1, "s", xml);
+	return TRUE;
+}
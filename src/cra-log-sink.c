@@ -0,0 +1,360 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cra-cleanup.h"
+#include "cra-log-sink.h"
+#include "cra-plugin.h"
+
+/* how many logs to write in one go */
+#define CRA_LOG_SINK_BATCH_SIZE		64
+
+typedef struct {
+	gchar		*name;		/* %NULL to stop the thread */
+	GString		*log;
+} CraLogSinkItem;
+
+struct CraLogSink {
+	gchar		*log_dir;
+	FILE		*archive;	/* or %NULL for one file per log */
+	FILE		*index;
+	guint64		 offset;	/* of the end of the archive */
+	GAsyncQueue	*queue;		/* of CraLogSinkItem */
+	GThread		*thread;	/* or %NULL to write in the caller */
+	GError		*error;		/* the first write failure */
+};
+
+/**
+ * cra_log_sink_item_free:
+ */
+static void
+cra_log_sink_item_free (CraLogSinkItem *item)
+{
+	if (item->log != NULL)
+		g_string_free (item->log, TRUE);
+	g_free (item->name);
+	g_free (item);
+}
+
+/**
+ * cra_log_sink_open:
+ */
+static FILE *
+cra_log_sink_open (const gchar *filename, gboolean append, GError **error)
+{
+	FILE *fp;
+
+	fp = fopen (filename, append ? "a" : "w");
+	if (fp == NULL) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to open %s: %s",
+			     filename, g_strerror (errno));
+	}
+	return fp;
+}
+
+/**
+ * cra_log_sink_new:
+ *
+ * Creates a sink that writes each log to <log-dir>/<name>.log, or if
+ * @archive is set, appends them all to <log-dir>/<archive>.log.gz with an
+ * index of where each one is in <log-dir>/<archive>.log.idx.
+ */
+CraLogSink *
+cra_log_sink_new (const gchar *log_dir,
+		  const gchar *archive,
+		  gboolean append,
+		  GError **error)
+{
+	CraLogSink *sink;
+	_cleanup_free_ gchar *fn_archive = NULL;
+	_cleanup_free_ gchar *fn_index = NULL;
+
+	sink = g_new0 (CraLogSink, 1);
+	sink->log_dir = g_strdup (log_dir);
+	sink->queue = g_async_queue_new ();
+	if (archive == NULL)
+		return sink;
+
+	fn_archive = g_strdup_printf ("%s/%s.log.gz", log_dir, archive);
+	fn_index = g_strdup_printf ("%s/%s.log.idx", log_dir, archive);
+	sink->archive = cra_log_sink_open (fn_archive, append, error);
+	if (sink->archive == NULL)
+		goto fail;
+
+	/* each member is one write, so a failure never leaves it buffered */
+	setvbuf (sink->archive, NULL, _IONBF, 0);
+	sink->index = cra_log_sink_open (fn_index, append, error);
+	if (sink->index == NULL)
+		goto fail;
+	fseek (sink->archive, 0, SEEK_END);
+	sink->offset = ftell (sink->archive);
+	return sink;
+fail:
+	cra_log_sink_free (sink);
+	return NULL;
+}
+
+/**
+ * cra_log_sink_compress:
+ *
+ * Each log is a separate gzip member, so it can be read on its own and the
+ * whole archive can still be read with zcat.
+ */
+static GBytes *
+cra_log_sink_compress (GString *log, GError **error)
+{
+	_cleanup_object_unref_ GConverter *conv = NULL;
+	_cleanup_object_unref_ GOutputStream *mem = NULL;
+	_cleanup_object_unref_ GOutputStream *out = NULL;
+
+	conv = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+	mem = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+	out = g_converter_output_stream_new (mem, conv);
+	if (!g_output_stream_write_all (out, log->str, log->len, NULL, NULL, error))
+		return NULL;
+	if (!g_output_stream_close (out, NULL, error))
+		return NULL;
+	return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (mem));
+}
+
+/**
+ * cra_log_sink_write_file:
+ *
+ * The logs are only for reference, so this does not need the fsync and
+ * rename that g_file_set_contents() does.
+ */
+static gboolean
+cra_log_sink_write_file (CraLogSink *sink, CraLogSinkItem *item, GError **error)
+{
+	FILE *fp;
+	gboolean ret = TRUE;
+	_cleanup_free_ gchar *filename = NULL;
+
+	filename = g_strdup_printf ("%s/%s.log", sink->log_dir, item->name);
+	fp = cra_log_sink_open (filename, FALSE, error);
+	if (fp == NULL)
+		return FALSE;
+	if (fwrite (item->log->str, 1, item->log->len, fp) != item->log->len) {
+		ret = FALSE;
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to write %s: %s",
+			     filename, g_strerror (errno));
+	}
+	fclose (fp);
+	return ret;
+}
+
+/**
+ * cra_log_sink_write_archive:
+ */
+static gboolean
+cra_log_sink_write_archive (CraLogSink *sink, GPtrArray *batch, GError **error)
+{
+	CraLogSinkItem *item;
+	GString *index;
+	gsize len;
+	guint i;
+
+	index = g_string_new (NULL);
+	for (i = 0; i < batch->len; i++) {
+		_cleanup_bytes_unref_ GBytes *data = NULL;
+		item = g_ptr_array_index (batch, i);
+		data = cra_log_sink_compress (item->log, error);
+		if (data == NULL)
+			break;
+		len = g_bytes_get_size (data);
+		if (fwrite (g_bytes_get_data (data, NULL),
+			    1, len, sink->archive) != len) {
+			g_set_error (error,
+				     CRA_PLUGIN_ERROR,
+				     CRA_PLUGIN_ERROR_FAILED,
+				     "Failed to write log archive: %s",
+				     g_strerror (errno));
+
+			/* drop the partial member so the index still matches */
+			if (ftruncate (fileno (sink->archive), sink->offset) != 0)
+				g_warning ("failed to truncate log archive: %s",
+					   g_strerror (errno));
+			clearerr (sink->archive);
+			fseek (sink->archive, sink->offset, SEEK_SET);
+			break;
+		}
+		g_string_append_printf (index,
+					"%s\t%" G_GUINT64_FORMAT "\t%" G_GSIZE_FORMAT "\n",
+					item->name, sink->offset, len);
+		sink->offset += len;
+	}
+
+	/* only index the members that were written in full */
+	fwrite (index->str, 1, index->len, sink->index);
+	fflush (sink->index);
+	g_string_free (index, TRUE);
+	return i == batch->len;
+}
+
+/**
+ * cra_log_sink_write:
+ */
+static void
+cra_log_sink_write (CraLogSink *sink, GPtrArray *batch)
+{
+	CraLogSinkItem *item;
+	guint i;
+	_cleanup_error_free_ GError *error = NULL;
+
+	if (sink->archive != NULL) {
+		cra_log_sink_write_archive (sink, batch, &error);
+	} else {
+		for (i = 0; i < batch->len && error == NULL; i++) {
+			item = g_ptr_array_index (batch, i);
+			cra_log_sink_write_file (sink, item, &error);
+		}
+	}
+	if (error == NULL)
+		return;
+	g_warning ("failed to write logs: %s", error->message);
+	if (sink->error == NULL) {
+		sink->error = error;
+		error = NULL;
+	}
+}
+
+/**
+ * cra_log_sink_thread_func:
+ */
+static gpointer
+cra_log_sink_thread_func (gpointer data)
+{
+	CraLogSink *sink = (CraLogSink *) data;
+	CraLogSinkItem *item;
+	gboolean done = FALSE;
+	_cleanup_ptrarray_unref_ GPtrArray *batch = NULL;
+
+	batch = g_ptr_array_new_with_free_func ((GDestroyNotify) cra_log_sink_item_free);
+	while (!done) {
+		/* wait for one, then take anything else that is waiting */
+		item = g_async_queue_pop (sink->queue);
+		while (item != NULL) {
+			if (item->name == NULL) {
+				cra_log_sink_item_free (item);
+				done = TRUE;
+				break;
+			}
+			g_ptr_array_add (batch, item);
+			if (batch->len >= CRA_LOG_SINK_BATCH_SIZE)
+				break;
+			item = g_async_queue_try_pop (sink->queue);
+		}
+		if (batch->len > 0) {
+			cra_log_sink_write (sink, batch);
+			g_ptr_array_set_size (batch, 0);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * cra_log_sink_start:
+ *
+ * Starts a thread to do the writing. Until this is called, or if it is
+ * never called, logs are written by the caller of cra_log_sink_add().
+ */
+void
+cra_log_sink_start (CraLogSink *sink)
+{
+	sink->thread = g_thread_new ("log-sink", cra_log_sink_thread_func, sink);
+}
+
+/**
+ * cra_log_sink_add:
+ *
+ * Takes ownership of @log. This never waits for the disk if the writer
+ * thread has been started.
+ */
+void
+cra_log_sink_add (CraLogSink *sink, const gchar *name, GString *log)
+{
+	CraLogSinkItem *item;
+	_cleanup_ptrarray_unref_ GPtrArray *batch = NULL;
+
+	item = g_new0 (CraLogSinkItem, 1);
+	item->name = g_strdup (name);
+	item->log = log;
+	if (sink->thread != NULL) {
+		g_async_queue_push (sink->queue, item);
+		return;
+	}
+	batch = g_ptr_array_new_with_free_func ((GDestroyNotify) cra_log_sink_item_free);
+	g_ptr_array_add (batch, item);
+	cra_log_sink_write (sink, batch);
+}
+
+/**
+ * cra_log_sink_close:
+ *
+ * Waits for all the logs to be written, and reports the first failure.
+ */
+gboolean
+cra_log_sink_close (CraLogSink *sink, GError **error)
+{
+	if (sink->thread != NULL) {
+		g_async_queue_push (sink->queue, g_new0 (CraLogSinkItem, 1));
+		g_thread_join (sink->thread);
+		sink->thread = NULL;
+	}
+	if (sink->archive != NULL) {
+		fclose (sink->archive);
+		sink->archive = NULL;
+	}
+	if (sink->index != NULL) {
+		fclose (sink->index);
+		sink->index = NULL;
+	}
+	if (sink->error != NULL) {
+		g_propagate_error (error, sink->error);
+		sink->error = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * cra_log_sink_free:
+ */
+void
+cra_log_sink_free (CraLogSink *sink)
+{
+	cra_log_sink_close (sink, NULL);
+	g_async_queue_unref (sink->queue);
+	g_free (sink->log_dir);
+	g_free (sink);
+}
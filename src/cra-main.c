@@ -23,10 +23,18 @@
 
 #include "cra-cleanup.h"
 #include "cra-context.h"
+#include "cra-executor.h"
+#include "cra-governor.h"
+#include "cra-journal.h"
+#include "cra-memory.h"
+#include "cra-metrics.h"
 #include "cra-package.h"
 #include "cra-plugin.h"
 #include "cra-plugin-loader.h"
+#include "cra-probes.h"
+#include "cra-profile.h"
 #include "cra-utils.h"
+#include "cra-worker.h"
 
 #ifdef HAVE_RPM
 #include "cra-package-rpm.h"
@@ -37,16 +45,40 @@
 #include <appstream-glib.h>
 #include <gio/gio.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <locale.h>
+#include <stdio.h>
+#include <string.h>
 
 typedef struct {
+	CraContext	*ctx;
 	gchar		*filename;
 	gchar		*tmpdir;
 	CraPackage	*pkg;
 	guint		 id;
 	GPtrArray	*plugins_to_run;
+	GPtrArray	*apps;		/* of CraApp, only used by one worker */
+	guint64		 disk_reserved;
+	guint64		 memory_reserved;
+	guint64		 counters[CRA_PROGRESS_COUNTER_LAST];
+	GString		*log;		/* only used by worker processes */
 } CraTask;
 
+typedef struct {
+	CraPlugin	*plugin;
+	CraPackage	*pkg;
+	const gchar	*tmpdir;
+	GPtrArray	*filenames;
+	GList		**apps;		/* one list for each filename */
+	GError		**errors;	/* one error for each filename */
+	gint		 failed;
+} CraSubtasks;
+
+typedef struct {
+	CraSubtasks	*st;
+	guint		 idx;
+} CraSubtask;
+
 /**
  * cra_task_free:
  */
@@ -55,11 +87,59 @@ cra_task_free (CraTask *task)
 {
 	g_object_unref (task->pkg);
 	g_ptr_array_unref (task->plugins_to_run);
+	g_ptr_array_unref (task->apps);
+	if (task->log != NULL)
+		g_string_free (task->log, TRUE);
 	g_free (task->filename);
 	g_free (task->tmpdir);
 	g_free (task);
 }
 
+/**
+ * cra_task_count:
+ *
+ * Worker processes cannot update the progress directly, so the counters are
+ * also kept on the task and sent back with the results.
+ */
+static void
+cra_task_count (CraTask *task, CraProgressCounter counter, guint64 value)
+{
+	task->counters[counter] += value;
+	if (task->ctx->executor != NULL && task->ctx->progress != NULL)
+		cra_progress_add (task->ctx->progress, counter, value);
+}
+
+/**
+ * cra_context_flush_log:
+ */
+static void
+cra_context_flush_log (CraContext *ctx, CraPackage *pkg)
+{
+	if (ctx->log_sink == NULL)
+		return;
+	cra_log_sink_add (ctx->log_sink,
+			  cra_package_get_name (pkg),
+			  cra_package_get_log (pkg));
+}
+
+/**
+ * cra_task_flush_log:
+ *
+ * Worker processes send the log back with the results, as only the
+ * coordinator writes to the log sink.
+ */
+static void
+cra_task_flush_log (CraTask *task)
+{
+	if (task->ctx->executor == NULL) {
+		if (task->log != NULL)
+			g_string_free (task->log, TRUE);
+		task->log = cra_package_get_log (task->pkg);
+		return;
+	}
+	cra_context_flush_log (task->ctx, task->pkg);
+}
+
 /**
  * cra_task_add_suitable_plugins:
  */
@@ -92,43 +172,13 @@ cra_task_add_suitable_plugins (CraTask *task, GPtrArray *plugins)
 }
 
 /**
- * cra_context_explode_extra_package:
+ * cra_context_get_extra_packages:
  */
-static gboolean
-cra_context_explode_extra_package (CraContext *ctx,
-				   CraTask *task,
-				   const gchar *pkg_name)
+static GPtrArray *
+cra_context_get_extra_packages (CraContext *ctx, CraTask *task)
 {
 	CraPackage *pkg_extra;
-	gboolean ret = TRUE;
-	_cleanup_error_free_ GError *error = NULL;
-
-	/* if not found, that's fine */
-	pkg_extra = cra_context_find_by_pkgname (ctx, pkg_name);
-	if (pkg_extra == NULL)
-		return TRUE;
-	cra_package_log (task->pkg,
-			 CRA_PACKAGE_LOG_LEVEL_DEBUG,
-			 "Adding extra package %s for %s",
-			 cra_package_get_name (pkg_extra),
-			 cra_package_get_name (task->pkg));
-	ret = cra_package_explode (pkg_extra, task->tmpdir,
-				   ctx->file_globs, &error);
-	if (!ret) {
-		cra_package_log (task->pkg,
-				 CRA_PACKAGE_LOG_LEVEL_WARNING,
-				 "Failed to explode extra file: %s",
-				 error->message);
-	}
-	return ret;
-}
-
-/**
- * cra_context_explode_extra_packages:
- */
-static gboolean
-cra_context_explode_extra_packages (CraContext *ctx, CraTask *task)
-{
+	GPtrArray *extra;
 	const gchar *tmp;
 	guint i;
 	_cleanup_ptrarray_unref_ GPtrArray *array;
@@ -144,14 +194,118 @@ cra_context_explode_extra_packages (CraContext *ctx, CraTask *task)
 	tmp = cra_package_get_name (task->pkg);
 	g_ptr_array_add (array, g_strdup_printf ("%s-data", tmp));
 	g_ptr_array_add (array, g_strdup_printf ("%s-common", tmp));
+
+	/* if not found, that's fine */
+	extra = g_ptr_array_new ();
 	for (i = 0; i < array->len; i++) {
 		tmp = g_ptr_array_index (array, i);
-		if (!cra_context_explode_extra_package (ctx, task, tmp))
+		pkg_extra = cra_context_find_by_pkgname (ctx, tmp);
+		if (pkg_extra != NULL)
+			g_ptr_array_add (extra, pkg_extra);
+	}
+	return extra;
+}
+
+/**
+ * cra_context_explode_extra_packages:
+ */
+static gboolean
+cra_context_explode_extra_packages (CraContext *ctx,
+				    CraTask *task,
+				    GPtrArray *extra)
+{
+	CraPackage *pkg_extra;
+	guint i;
+	_cleanup_error_free_ GError *error = NULL;
+
+	for (i = 0; i < extra->len; i++) {
+		pkg_extra = g_ptr_array_index (extra, i);
+		cra_package_log (task->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_DEBUG,
+				 "Adding extra package %s for %s",
+				 cra_package_get_name (pkg_extra),
+				 cra_package_get_name (task->pkg));
+		if (!cra_package_explode (pkg_extra, task->tmpdir,
+					  ctx->file_globs, &error)) {
+			cra_package_log (task->pkg,
+					 CRA_PACKAGE_LOG_LEVEL_WARNING,
+					 "Failed to explode extra file: %s",
+					 error->message);
 			return FALSE;
+		}
 	}
 	return TRUE;
 }
 
+/**
+ * cra_task_get_reservation:
+ *
+ * Works out how much temporary space and memory is needed to explode the
+ * package and any extra packages. Each package is read into memory to be
+ * decompressed, and the matching files are written to the temp dir.
+ */
+static void
+cra_task_get_reservation (CraContext *ctx, CraTask *task, GPtrArray *extra)
+{
+	CraPackage *pkg;
+	GStatBuf stat_buf;
+	guint i;
+
+	task->memory_reserved = 0;
+	task->disk_reserved = cra_package_get_explode_size (task->pkg,
+							    ctx->file_globs);
+	if (g_stat (cra_package_get_filename (task->pkg), &stat_buf) == 0)
+		task->memory_reserved = stat_buf.st_size;
+	for (i = 0; i < extra->len; i++) {
+		pkg = g_ptr_array_index (extra, i);
+		task->disk_reserved += cra_package_get_explode_size (pkg,
+								     ctx->file_globs);
+		if (g_stat (cra_package_get_filename (pkg), &stat_buf) == 0)
+			task->memory_reserved += stat_buf.st_size;
+	}
+}
+
+/**
+ * cra_task_reserve:
+ *
+ * Waits until there is enough temporary space and memory to explode the
+ * package and any extra packages.
+ */
+static void
+cra_task_reserve (CraContext *ctx, CraTask *task, GPtrArray *extra)
+{
+	gint64 profile;
+
+	cra_task_get_reservation (ctx, task, extra);
+	profile = cra_profile_start ();
+	if (cra_governor_reserve (ctx->governor,
+				  task->disk_reserved,
+				  task->memory_reserved)) {
+		cra_package_log (task->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_DEBUG,
+				 "Waited for %" G_GUINT64_FORMAT " bytes of "
+				 "temp space and %" G_GUINT64_FORMAT
+				 " bytes of memory",
+				 task->disk_reserved,
+				 task->memory_reserved);
+	}
+	cra_profile_stop (profile, task->pkg, "reserve", NULL);
+}
+
+/**
+ * cra_task_release:
+ */
+static void
+cra_task_release (CraContext *ctx, CraTask *task, gboolean disk)
+{
+	if (disk) {
+		cra_governor_release (ctx->governor, task->disk_reserved, 0);
+		task->disk_reserved = 0;
+	}
+	cra_governor_release (ctx->governor, 0, task->memory_reserved);
+	task->memory_reserved = 0;
+}
+
 /**
  * cra_context_check_urls:
  */
@@ -180,17 +334,115 @@ cra_context_check_urls (AsApp *app, CraPackage *pkg)
 	}
 }
 
+/**
+ * cra_task_is_cancelled:
+ */
+static gboolean
+cra_task_is_cancelled (CraTask *task)
+{
+	return g_cancellable_is_cancelled (cra_package_get_cancellable (task->pkg));
+}
+
+/**
+ * cra_subtask_func:
+ */
+static void
+cra_subtask_func (gpointer data)
+{
+	CraSubtask *sub = (CraSubtask *) data;
+	CraSubtasks *st = sub->st;
+	const gchar *filename;
+
+	/* no point doing any more work if the package has failed */
+	if (g_atomic_int_get (&st->failed))
+		return;
+	if (g_cancellable_is_cancelled (cra_package_get_cancellable (st->pkg)))
+		return;
+	filename = g_ptr_array_index (st->filenames, sub->idx);
+	if (!cra_plugin_process_file (st->plugin,
+				      st->pkg,
+				      filename,
+				      &st->apps[sub->idx],
+				      st->tmpdir,
+				      &st->errors[sub->idx]))
+		g_atomic_int_set (&st->failed, TRUE);
+}
+
+/**
+ * cra_task_process_files:
+ */
+static GList *
+cra_task_process_files (CraTask *task,
+			CraPlugin *plugin,
+			GPtrArray *filenames,
+			GError **error)
+{
+	CraExecutorGroup *group;
+	CraSubtask *subs;
+	CraSubtasks st = { NULL };
+	GList *apps = NULL;
+	guint i;
+
+	/* spawn a child for each file; idle workers steal them from us */
+	st.plugin = plugin;
+	st.pkg = task->pkg;
+	st.tmpdir = task->tmpdir;
+	st.filenames = filenames;
+	st.apps = g_new0 (GList *, filenames->len);
+	st.errors = g_new0 (GError *, filenames->len);
+	subs = g_new0 (CraSubtask, filenames->len);
+	group = cra_executor_group_new (cra_executor_get_current ());
+	for (i = 0; i < filenames->len; i++) {
+		subs[i].st = &st;
+		subs[i].idx = i;
+		cra_executor_group_push (group, cra_subtask_func, &subs[i]);
+	}
+	cra_executor_group_free (group);
+
+	/* join in filelist order so the result does not depend on timing */
+	for (i = 0; i < filenames->len; i++) {
+		if (st.errors[i] != NULL) {
+			g_propagate_error (error, st.errors[i]);
+			st.errors[i] = NULL;
+			g_list_free_full (apps, (GDestroyNotify) g_object_unref);
+			apps = NULL;
+			goto out;
+		}
+		apps = g_list_concat (apps, st.apps[i]);
+		st.apps[i] = NULL;
+	}
+
+	/* no files we care about */
+	if (apps == NULL) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "nothing interesting in %s",
+			     cra_package_get_basename (task->pkg));
+	}
+out:
+	for (i = 0; i < filenames->len; i++) {
+		g_list_free_full (st.apps[i], (GDestroyNotify) g_object_unref);
+		if (st.errors[i] != NULL)
+			g_error_free (st.errors[i]);
+	}
+	g_free (st.apps);
+	g_free (st.errors);
+	g_free (subs);
+	return apps;
+}
+
 /**
  * cra_task_process_func:
  */
 static void
-cra_task_process_func (gpointer data, gpointer user_data)
+cra_task_process_func (gpointer data)
 {
 	CraApp *app;
-	CraContext *ctx = (CraContext *) user_data;
 	CraPlugin *plugin = NULL;
 	AsRelease *release;
 	CraTask *task = (CraTask *) data;
+	CraContext *ctx = task->ctx;
 	gboolean ret;
 	gboolean valid;
 	gchar *cache_id;
@@ -198,6 +450,8 @@ cra_task_process_func (gpointer data, gpointer user_data)
 	GList *apps = NULL;
 	GList *l;
 	GPtrArray *array;
+	gint64 profile;
+	gint64 profile_task;
 	guint i;
 	guint nr_added = 0;
 	const gchar * const *kudos;
@@ -205,7 +459,11 @@ cra_task_process_func (gpointer data, gpointer user_data)
 	_cleanup_free_ gchar *basename = NULL;
 
 	/* reset the profile timer */
+	profile_task = cra_profile_start ();
 	cra_package_log_start (task->pkg);
+	cra_package_set_stage (task->pkg, NULL, "match");
+	if (ctx->watchdog != NULL)
+		cra_watchdog_add (ctx->watchdog, task->pkg);
 
 	/* did we get a file match on any plugin */
 	basename = g_path_get_basename (task->filename);
@@ -229,12 +487,20 @@ cra_task_process_func (gpointer data, gpointer user_data)
 	}
 
 	/* explode tree */
+	cra_package_set_stage (task->pkg, NULL, "explode");
 	cra_package_log (task->pkg,
 			 CRA_PACKAGE_LOG_LEVEL_DEBUG,
 			 "Exploding tree for %s",
 			 cra_package_get_name (task->pkg));
 	if (!ctx->use_package_cache ||
 	    !g_file_test (task->tmpdir, G_FILE_TEST_EXISTS)) {
+		_cleanup_ptrarray_unref_ GPtrArray *extra = NULL;
+		extra = cra_context_get_extra_packages (ctx, task);
+		cra_task_reserve (ctx, task, extra);
+		CRA_PROBE2 (explode__start,
+			    cra_package_get_name (task->pkg),
+			    task->disk_reserved);
+		profile = cra_profile_start ();
 		ret = cra_package_explode (task->pkg,
 					   task->tmpdir,
 					   ctx->file_globs,
@@ -244,24 +510,60 @@ cra_task_process_func (gpointer data, gpointer user_data)
 					 CRA_PACKAGE_LOG_LEVEL_WARNING,
 					 "Failed to explode: %s", error->message);
 			g_clear_error (&error);
-			goto skip;
+		} else {
+			/* add extra packages */
+			ret = cra_context_explode_extra_packages (ctx, task, extra);
 		}
-
-		/* add extra packages */
-		ret = cra_context_explode_extra_packages (ctx, task);
+		cra_profile_stop (profile, task->pkg, "explode", NULL);
+		CRA_PROBE3 (explode__end,
+			    cra_package_get_name (task->pkg),
+			    task->disk_reserved,
+			    ret);
+
+		/* the temp space is still used until the tree is deleted */
+		cra_task_release (ctx, task, FALSE);
 		if (!ret)
 			goto skip;
+		cra_task_count (task, CRA_PROGRESS_COUNTER_EXPLODED, 1);
+		cra_task_count (task, CRA_PROGRESS_COUNTER_BYTES,
+				task->disk_reserved);
 	}
+	if (cra_task_is_cancelled (task))
+		goto skip;
 
 	/* run plugins */
 	for (i = 0; i < task->plugins_to_run->len; i++) {
+		_cleanup_ptrarray_unref_ GPtrArray *filenames = NULL;
 		plugin = g_ptr_array_index (task->plugins_to_run, i);
+		cra_package_set_stage (task->pkg, plugin->name, "process");
 		cra_package_log (task->pkg,
 				 CRA_PACKAGE_LOG_LEVEL_DEBUG,
 				 "Processing %s with %s",
 				 basename,
 				 plugin->name);
-		apps = cra_plugin_process (plugin, task->pkg, task->tmpdir, &error);
+
+		/* split up the package if the plugin can do single files */
+		CRA_PROBE3 (plugin__entry,
+			    plugin->name, "process",
+			    cra_package_get_name (task->pkg));
+		profile = cra_profile_start ();
+		filenames = cra_plugin_get_process_files (plugin, task->pkg);
+		if (filenames != NULL) {
+			apps = cra_task_process_files (task, plugin,
+						       filenames, &error);
+		} else {
+			apps = cra_plugin_process (plugin, task->pkg,
+						   task->tmpdir, &error);
+		}
+		cra_profile_stop (profile, task->pkg, "process", plugin->name);
+		CRA_PROBE4 (plugin__exit,
+			    plugin->name, "process",
+			    cra_package_get_name (task->pkg),
+			    apps != NULL);
+		if (cra_task_is_cancelled (task)) {
+			g_clear_error (&error);
+			break;
+		}
 		if (apps == NULL) {
 			cra_package_log (task->pkg,
 					 CRA_PACKAGE_LOG_LEVEL_WARNING,
@@ -270,13 +572,17 @@ cra_task_process_func (gpointer data, gpointer user_data)
 			g_clear_error (&error);
 		}
 	}
-	if (apps == NULL)
+	if (apps == NULL || cra_task_is_cancelled (task))
 		goto skip;
 
 	/* print */
 	for (l = apps; l != NULL; l = l->next) {
 		app = l->data;
 
+		/* keep what has already been finished */
+		if (cra_task_is_cancelled (task))
+			break;
+
 		/* all apps assumed to be okay */
 		valid = TRUE;
 
@@ -325,14 +631,14 @@ cra_task_process_func (gpointer data, gpointer user_data)
 
 		/* don't include components that have no name or comment */
 		if (as_app_get_name (AS_APP (app), "C") == NULL)
-			cra_app_add_veto (app, "Has no Name");
+			cra_app_add_veto (app, "no-name", "Has no Name");
 		if (as_app_get_comment (AS_APP (app), "C") == NULL)
-			cra_app_add_veto (app, "Has no Comment");
+			cra_app_add_veto (app, "no-comment", "Has no Comment");
 
 		/* don't include apps that have no icon */
 		if (as_app_get_id_kind (AS_APP (app)) != AS_ID_KIND_ADDON) {
 			if (as_app_get_icon (AS_APP (app)) == NULL)
-				cra_app_add_veto (app, "Has no Icon");
+				cra_app_add_veto (app, "no-icon", "Has no Icon");
 		}
 
 		/* list all the reasons we're ignoring the app */
@@ -368,15 +674,24 @@ cra_task_process_func (gpointer data, gpointer user_data)
 			}
 			valid = FALSE;
 		}
-		if (!valid)
+		if (!valid) {
+			CRA_PROBE3 (app__vetoed,
+				    cra_package_get_name (task->pkg),
+				    as_app_get_id_full (AS_APP (app)),
+				    cra_app_get_vetos (app)->len);
+			cra_task_count (task, CRA_PROGRESS_COUNTER_VETOED, 1);
 			continue;
+		}
 
 		/* verify URLs still exist */
 		if (ctx->extra_checks)
 			cra_context_check_urls (AS_APP (app), task->pkg);
 
 		/* save icon and screenshots */
+		cra_package_set_stage (task->pkg, NULL, "save-resources");
+		profile = cra_profile_start ();
 		ret = cra_app_save_resources (app, &error);
+		cra_profile_stop (profile, task->pkg, "save-resources", NULL);
 		if (!ret) {
 			cra_package_log (task->pkg,
 					 CRA_PACKAGE_LOG_LEVEL_WARNING,
@@ -407,18 +722,27 @@ cra_task_process_func (gpointer data, gpointer user_data)
 		}
 
 		/* all okay */
-		cra_context_add_app (ctx, app);
+		g_ptr_array_add (task->apps, g_object_ref (app));
+		CRA_PROBE2 (app__accepted,
+			    cra_package_get_name (task->pkg),
+			    as_app_get_id_full (AS_APP (app)));
+		cra_task_count (task, CRA_PROGRESS_COUNTER_APPS, 1);
 		nr_added++;
 
-		/* log the XML in the log file */
-		tmp = cra_app_to_xml (app);
-		cra_package_log (task->pkg, CRA_PACKAGE_LOG_LEVEL_NONE, "%s", tmp);
-		g_free (tmp);
+		/* log the XML in the log file, which is an extra serialization
+		 * of each component so is only done when asked */
+		if (ctx->log_xml) {
+			tmp = cra_app_to_xml (app);
+			cra_package_log (task->pkg,
+					 CRA_PACKAGE_LOG_LEVEL_NONE,
+					 "%s", tmp);
+			g_free (tmp);
+		}
 	}
 skip:
 	/* add a dummy element to the AppStream metadata so that we don't keep
-	 * parsing this every time */
-	if (ctx->add_cache_id && nr_added == 0) {
+	 * parsing this every time, unless it ran out of time */
+	if (ctx->add_cache_id && nr_added == 0 && !cra_task_is_cancelled (task)) {
 		_cleanup_object_unref_ AsApp *dummy;
 		dummy = as_app_new ();
 		as_app_set_id_full (dummy, cra_package_get_name (task->pkg), -1);
@@ -426,11 +750,12 @@ skip:
 		as_app_add_metadata (dummy,
 				     "X-CreaterepoAsCacheID",
 				     cache_id, -1);
-		cra_context_add_app (ctx, (CraApp *) dummy);
+		g_ptr_array_add (task->apps, g_object_ref (dummy));
 		g_free (cache_id);
 	}
 
 	/* delete tree */
+	cra_package_set_stage (task->pkg, NULL, "delete");
 	if (!ctx->use_package_cache) {
 		if (!cra_utils_rmtree (task->tmpdir, &error)) {
 			cra_package_log (task->pkg,
@@ -440,23 +765,21 @@ skip:
 			goto out;
 		}
 	}
+	cra_task_release (ctx, task, TRUE);
 
 	/* write log */
-	if (!cra_package_log_flush (task->pkg, &error)) {
-		cra_package_log (task->pkg,
-				 CRA_PACKAGE_LOG_LEVEL_WARNING,
-				 "Failed to write package log: %s",
-				 error->message);
-		goto out;
-	}
-
-	/* update UI */
-	g_print ("Processed %i/%i %s\n",
-		 task->id + 1,
-		 ctx->packages->len,
-		 cra_package_get_name (task->pkg));
+	profile = cra_profile_start ();
+	cra_task_flush_log (task);
+	cra_profile_stop (profile, task->pkg, "log-flush", NULL);
 out:
+	cra_task_count (task, CRA_PROGRESS_COUNTER_PROCESSED, 1);
+	if (ctx->watchdog != NULL)
+		cra_watchdog_remove (ctx->watchdog, task->pkg);
+	cra_task_release (ctx, task, TRUE);
 	g_list_free_full (apps, (GDestroyNotify) g_object_unref);
+	cra_profile_stop (profile_task, task->pkg, "task", NULL);
+	cra_memory_sample (cra_package_get_name (task->pkg), NULL);
+	CRA_PROBE2 (package__close, cra_package_get_name (task->pkg), nr_added);
 }
 
 /**
@@ -465,6 +788,7 @@ out:
 static gboolean
 cra_context_add_filename (CraContext *ctx, const gchar *filename, GError **error)
 {
+	gint64 profile;
 	_cleanup_object_unref_ CraPackage *pkg = NULL;
 
 	/* open */
@@ -482,8 +806,11 @@ cra_context_add_filename (CraContext *ctx, const gchar *filename, GError **error
 			     filename);
 		return FALSE;
 	}
+	profile = cra_profile_start ();
 	if (!cra_package_open (pkg, filename, error))
 		return FALSE;
+	cra_profile_stop (profile, pkg, "open", NULL);
+	CRA_PROBE2 (package__open, filename, cra_package_get_name (pkg));
 
 	/* is package name blacklisted */
 	if (cra_glob_value_search (ctx->blacklisted_pkgs,
@@ -500,6 +827,29 @@ cra_context_add_filename (CraContext *ctx, const gchar *filename, GError **error
 	return TRUE;
 }
 
+/**
+ * cra_context_add_task_results:
+ *
+ * Adds the results from each task in the order the packages were added, so
+ * the application list does not depend on which worker finished first.
+ */
+static void
+cra_context_add_task_results (CraContext *ctx, GPtrArray *tasks)
+{
+	CraApp *app;
+	CraTask *task;
+	guint i;
+	guint j;
+
+	for (i = 0; i < tasks->len; i++) {
+		task = g_ptr_array_index (tasks, i);
+		for (j = 0; j < task->apps->len; j++) {
+			app = g_ptr_array_index (task->apps, j);
+			cra_context_add_app (ctx, app);
+		}
+	}
+}
+
 /**
  * cra_context_write_icons:
  */
@@ -529,14 +879,16 @@ cra_context_write_xml (CraContext *ctx,
 		       GError **error)
 {
 	AsApp *app;
-	GList *l;
+	GPtrArray *apps;
+	guint i;
 	_cleanup_free_ gchar *filename = NULL;
 	_cleanup_object_unref_ AsStore *store;
 	_cleanup_object_unref_ GFile *file;
 
 	store = as_store_new ();
-	for (l = ctx->apps; l != NULL; l = l->next) {
-		app = AS_APP (l->data);
+	apps = cra_store_get_apps (ctx->store);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
 		if (CRA_IS_APP (app)) {
 			if (cra_app_get_vetos(CRA_APP(app))->len > 0)
 				continue;
@@ -557,6 +909,527 @@ cra_context_write_xml (CraContext *ctx,
 				 NULL, error);
 }
 
+/**
+ * cra_context_in_shard:
+ *
+ * Packages are split between the shards using a hash of the filename, so
+ * the split does not depend on the order the packages were found in.
+ */
+static gboolean
+cra_context_in_shard (CraContext *ctx, const gchar *filename)
+{
+	_cleanup_free_ gchar *basename = NULL;
+
+	if (ctx->shard_nr == 0)
+		return TRUE;
+	basename = g_path_get_basename (filename);
+	return g_str_hash (basename) % ctx->shard_nr == ctx->shard_id - 1;
+}
+
+/**
+ * cra_context_apps_to_xml:
+ *
+ * Serializes the unmerged applications without going through an #AsStore,
+ * as that would drop duplicate IDs before the merge could veto them.
+ */
+static GString *
+cra_context_apps_to_xml (CraContext *ctx, GPtrArray *apps)
+{
+	AsApp *app;
+	GNode *apps_node;
+	GNode *root;
+	GString *xml;
+	guint i;
+	gchar version[G_ASCII_DTOSTR_BUF_SIZE];
+
+	/* the same API version cra_context_write_xml() uses */
+	g_ascii_dtostr (version, sizeof (version), ctx->api_version);
+	root = as_node_new ();
+	apps_node = as_node_insert (root, "applications", NULL, 0,
+				    "version", version,
+				    NULL);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+
+		/* so the merge knows which ones came from a package */
+		if (CRA_IS_APP (app)) {
+			as_app_add_metadata (app, "X-CreaterepoAsPackage",
+					     cra_app_get_package_nevr (CRA_APP (app)),
+					     -1);
+		}
+		as_app_node_insert (app, apps_node, ctx->api_version);
+	}
+	xml = as_node_to_xml (root,
+			      AS_NODE_TO_XML_FLAG_ADD_HEADER |
+			      AS_NODE_TO_XML_FLAG_FORMAT_INDENT |
+			      AS_NODE_TO_XML_FLAG_FORMAT_MULTILINE);
+	as_node_unref (root);
+	return xml;
+}
+
+/**
+ * cra_context_apps_from_xml:
+ *
+ * Adds the applications written by cra_context_apps_to_xml() to @apps, using
+ * a #CraApp for each one that came from a package.
+ */
+static gboolean
+cra_context_apps_from_xml (const gchar *xml,
+			   gssize len,
+			   GPtrArray *apps,
+			   GError **error)
+{
+	GNode *apps_node;
+	GNode *n;
+	GNode *root;
+	gboolean ret = TRUE;
+
+	root = as_node_from_xml (xml, len, AS_NODE_FROM_XML_FLAG_NONE, error);
+	if (root == NULL)
+		return FALSE;
+	apps_node = as_node_find (root, "applications");
+	if (apps_node == NULL) {
+		ret = FALSE;
+		g_set_error_literal (error,
+				     CRA_PLUGIN_ERROR,
+				     CRA_PLUGIN_ERROR_FAILED,
+				     "No applications found");
+		goto out;
+	}
+	for (n = apps_node->children; n != NULL; n = n->next) {
+		_cleanup_object_unref_ AsApp *app = NULL;
+		app = as_app_new ();
+		ret = as_app_node_parse (app, n, error);
+		if (!ret)
+			goto out;
+
+		/* extra metadata is not merged with the packages */
+		if (as_app_get_metadata_item (app, "X-CreaterepoAsPackage") == NULL) {
+			g_ptr_array_add (apps, g_object_ref (app));
+			continue;
+		}
+		g_object_unref (app);
+		app = AS_APP (cra_app_new (NULL, NULL));
+		ret = as_app_node_parse (app, n, error);
+		if (!ret)
+			goto out;
+		g_ptr_array_add (apps, g_object_ref (app));
+	}
+out:
+	as_node_unref (root);
+	return ret;
+}
+
+/**
+ * cra_context_write_shard:
+ */
+static gboolean
+cra_context_write_shard (CraContext *ctx,
+			 const gchar *output_dir,
+			 const gchar *basename,
+			 GError **error)
+{
+	_cleanup_free_ gchar *filename = NULL;
+	_cleanup_string_free_ GString *xml = NULL;
+
+	xml = cra_context_apps_to_xml (ctx, cra_store_get_apps (ctx->store));
+	filename = g_strdup_printf ("%s/%s.xml", output_dir, basename);
+	g_print ("Writing %s...\n", filename);
+	return g_file_set_contents (filename, xml->str, xml->len, error);
+}
+
+/**
+ * cra_context_load_shard:
+ */
+static gboolean
+cra_context_load_shard (CraContext *ctx, const gchar *filename, GError **error)
+{
+	gsize len;
+	guint i;
+	_cleanup_free_ gchar *data = NULL;
+	_cleanup_ptrarray_unref_ GPtrArray *apps = NULL;
+
+	if (!g_file_get_contents (filename, &data, &len, error))
+		return FALSE;
+	apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	if (!cra_context_apps_from_xml (data, len, apps, error))
+		return FALSE;
+	for (i = 0; i < apps->len; i++)
+		cra_store_add_app (ctx->store, g_ptr_array_index (apps, i));
+	return TRUE;
+}
+
+/**
+ * cra_task_journal:
+ *
+ * Records the results of the task so an interrupted run can be resumed.
+ */
+static void
+cra_task_journal (CraTask *task)
+{
+	AsApp *app;
+	CraContext *ctx = task->ctx;
+	guint i;
+	_cleanup_error_free_ GError *error = NULL;
+	_cleanup_free_ gchar *cache_id = NULL;
+	_cleanup_free_ gchar *icons_dir = NULL;
+	_cleanup_ptrarray_unref_ GPtrArray *icons = NULL;
+	_cleanup_string_free_ GString *xml = NULL;
+
+	if (ctx->journal == NULL)
+		return;
+
+	/* any icons we wrote */
+	icons_dir = g_build_filename (cra_package_get_config (task->pkg, "TempDir"),
+				      "icons", NULL);
+	icons = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < task->apps->len; i++) {
+		_cleanup_free_ gchar *filename = NULL;
+		app = g_ptr_array_index (task->apps, i);
+		if (as_app_get_icon_kind (app) != AS_ICON_KIND_CACHED)
+			continue;
+		if (as_app_get_icon (app) == NULL)
+			continue;
+		filename = g_build_filename (icons_dir, as_app_get_icon (app), NULL);
+		if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+			continue;
+		g_ptr_array_add (icons, g_strdup (as_app_get_icon (app)));
+	}
+
+	cache_id = cra_utils_get_cache_id_for_filename (task->filename);
+	xml = cra_context_apps_to_xml (ctx, task->apps);
+	if (!cra_journal_add (ctx->journal, cache_id, xml->str,
+			      icons_dir, icons, &error)) {
+		g_warning ("failed to journal %s: %s",
+			   cra_package_get_filename (task->pkg),
+			   error->message);
+	}
+}
+
+/**
+ * cra_task_restore:
+ *
+ * Adds the results of the task from the journal, if an earlier run got that
+ * far.
+ */
+static gboolean
+cra_task_restore (CraTask *task)
+{
+	CraContext *ctx = task->ctx;
+	_cleanup_error_free_ GError *error = NULL;
+	_cleanup_free_ gchar *cache_id = NULL;
+	_cleanup_free_ gchar *icons_dir = NULL;
+	_cleanup_free_ gchar *xml = NULL;
+
+	if (ctx->journal == NULL)
+		return FALSE;
+	cache_id = cra_utils_get_cache_id_for_filename (task->filename);
+	if (!cra_journal_contains (ctx->journal, cache_id))
+		return FALSE;
+	icons_dir = g_build_filename (cra_package_get_config (task->pkg, "TempDir"),
+				      "icons", NULL);
+	if (!cra_journal_restore (ctx->journal, cache_id, icons_dir,
+				  &xml, &error) ||
+	    !cra_context_apps_from_xml (xml, -1, task->apps, &error)) {
+		cra_package_log (task->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "Failed to restore from journal: %s",
+				 error->message);
+		g_ptr_array_set_size (task->apps, 0);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * cra_task_run_func:
+ */
+static void
+cra_task_run_func (gpointer data)
+{
+	CraTask *task = (CraTask *) data;
+	cra_task_process_func (task);
+	cra_task_journal (task);
+}
+
+/**
+ * cra_task_payload_add:
+ *
+ * Adds a length-prefixed block to the results of a worker process.
+ */
+static void
+cra_task_payload_add (GString *result, GString *block)
+{
+	guint32 len = 0;
+
+	if (block != NULL)
+		len = block->len;
+	g_string_append_len (result, (const gchar *) &len, sizeof (len));
+	if (block != NULL)
+		g_string_append_len (result, block->str, block->len);
+}
+
+/**
+ * cra_task_payload_get:
+ *
+ * Takes a block added with cra_task_payload_add() off the front of @data.
+ */
+static gboolean
+cra_task_payload_get (const gchar **data,
+		      gsize *len,
+		      const gchar **block,
+		      guint32 *block_len)
+{
+	if (*len < sizeof (*block_len))
+		return FALSE;
+	memcpy (block_len, *data, sizeof (*block_len));
+	*data += sizeof (*block_len);
+	*len -= sizeof (*block_len);
+	if (*len < *block_len)
+		return FALSE;
+	*block = *data;
+	*data += *block_len;
+	*len -= *block_len;
+	return TRUE;
+}
+
+/**
+ * cra_task_worker_func:
+ *
+ * Runs in a worker process, sending the results back as XML.
+ */
+static GString *
+cra_task_worker_func (guint idx, gpointer user_data)
+{
+	CraTask *task;
+	GPtrArray *tasks = (GPtrArray *) user_data;
+	GString *result;
+	_cleanup_string_free_ GString *memory = NULL;
+	_cleanup_string_free_ GString *metrics = NULL;
+	_cleanup_string_free_ GString *profile = NULL;
+	_cleanup_string_free_ GString *xml = NULL;
+
+	/* only send back the timings for this package */
+	cra_profile_reset ();
+	cra_memory_reset ();
+	cra_metrics_reset ();
+	task = g_ptr_array_index (tasks, idx);
+	cra_task_process_func (task);
+
+	/* the counters, the log, the timings, the memory accounting and the
+	 * metrics are sent before the XML */
+	xml = cra_context_apps_to_xml (task->ctx, task->apps);
+	profile = cra_profile_to_string ();
+	memory = cra_memory_to_string ();
+	metrics = cra_metrics_to_string ();
+	result = g_string_new (NULL);
+	g_string_append_len (result,
+			     (const gchar *) task->counters,
+			     sizeof (task->counters));
+	cra_task_payload_add (result, task->log);
+	cra_task_payload_add (result, profile);
+	cra_task_payload_add (result, memory);
+	cra_task_payload_add (result, metrics);
+	g_string_append_len (result, xml->str, xml->len);
+	return result;
+}
+
+/**
+ * cra_task_worker_result_func:
+ */
+static void
+cra_task_worker_result_func (guint idx,
+			     const gchar *data,
+			     gsize len,
+			     const GError *worker_error,
+			     gpointer user_data)
+{
+	CraTask *task;
+	GPtrArray *tasks = (GPtrArray *) user_data;
+	const gchar *log;
+	const gchar *memory;
+	const gchar *metrics;
+	const gchar *profile;
+	guint i;
+	guint32 log_len;
+	guint32 memory_len;
+	guint32 metrics_len;
+	guint32 profile_len;
+	_cleanup_error_free_ GError *error = NULL;
+
+	task = g_ptr_array_index (tasks, idx);
+	if (data == NULL) {
+		cra_progress_add (task->ctx->progress,
+				  CRA_PROGRESS_COUNTER_PROCESSED, 1);
+		g_warning ("%s processing %s",
+			   worker_error->message,
+			   cra_package_get_filename (task->pkg));
+		cra_package_log (task->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "%s processing %s",
+				 worker_error->message,
+				 cra_package_get_nevr (task->pkg));
+		cra_context_flush_log (task->ctx, task->pkg);
+		return;
+	}
+	if (len < sizeof (task->counters))
+		goto truncated;
+	memcpy (task->counters, data, sizeof (task->counters));
+	data += sizeof (task->counters);
+	len -= sizeof (task->counters);
+	if (!cra_task_payload_get (&data, &len, &log, &log_len) ||
+	    !cra_task_payload_get (&data, &len, &profile, &profile_len) ||
+	    !cra_task_payload_get (&data, &len, &memory, &memory_len) ||
+	    !cra_task_payload_get (&data, &len, &metrics, &metrics_len))
+		goto truncated;
+	for (i = 0; i < CRA_PROGRESS_COUNTER_LAST; i++)
+		cra_progress_add (task->ctx->progress, i, task->counters[i]);
+	if (task->ctx->log_sink != NULL) {
+		cra_log_sink_add (task->ctx->log_sink,
+				  cra_package_get_name (task->pkg),
+				  g_string_new_len (log, log_len));
+	}
+	cra_profile_add_from_string (profile, profile_len);
+	cra_memory_add_from_string (memory, memory_len);
+	cra_metrics_add_from_string (metrics, metrics_len);
+	if (!cra_context_apps_from_xml (data, len, task->apps, &error)) {
+		g_warning ("failed to parse results for %s: %s",
+			   cra_package_get_filename (task->pkg),
+			   error->message);
+		return;
+	}
+	cra_task_journal (task);
+	return;
+truncated:
+	g_warning ("truncated results for %s",
+		   cra_package_get_filename (task->pkg));
+}
+
+/**
+ * cra_task_worker_admit_func:
+ *
+ * Runs in the coordinator, as each worker process only has its own copy of
+ * the governor and would always let its one package through.
+ */
+static gboolean
+cra_task_worker_admit_func (guint idx, gboolean admit, gpointer user_data)
+{
+	CraContext *ctx;
+	CraTask *task;
+	GPtrArray *tasks = (GPtrArray *) user_data;
+	_cleanup_ptrarray_unref_ GPtrArray *extra = NULL;
+
+	task = g_ptr_array_index (tasks, idx);
+	ctx = task->ctx;
+	if (!admit) {
+		cra_governor_release (ctx->worker_governor,
+				      task->disk_reserved,
+				      task->memory_reserved);
+		task->disk_reserved = 0;
+		task->memory_reserved = 0;
+		return TRUE;
+	}
+
+	/* the worker will not explode anything */
+	if (ctx->use_package_cache &&
+	    g_file_test (task->tmpdir, G_FILE_TEST_EXISTS))
+		return TRUE;
+	extra = cra_context_get_extra_packages (ctx, task);
+	cra_task_get_reservation (ctx, task, extra);
+	if (!cra_governor_try_reserve (ctx->worker_governor,
+				       task->disk_reserved,
+				       task->memory_reserved)) {
+		task->disk_reserved = 0;
+		task->memory_reserved = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * cra_context_load_shards:
+ *
+ * Loads the applications and icons written by each of the shards, in shard
+ * order. All the shards have to be present.
+ */
+static gboolean
+cra_context_load_shards (CraContext *ctx,
+			 const gchar *temp_dir,
+			 const gchar *output_dir,
+			 const gchar *basename,
+			 GError **error)
+{
+	const gchar *tmp;
+	guint i;
+	guint shard_id;
+	guint shard_nr = 0;
+	_cleanup_dir_close_ GDir *dir = NULL;
+	_cleanup_free_ gchar *icons_dir = NULL;
+	_cleanup_free_ gchar *prefix = NULL;
+
+	/* find out how many shards there were */
+	prefix = g_strdup_printf ("%s-shard-", basename);
+	dir = g_dir_open (output_dir, 0, error);
+	if (dir == NULL)
+		return FALSE;
+	while ((tmp = g_dir_read_name (dir)) != NULL) {
+		if (!g_str_has_prefix (tmp, prefix))
+			continue;
+		if (sscanf (tmp + strlen (prefix), "%u-of-%u.xml",
+			    &shard_id, &shard_nr) == 2)
+			break;
+	}
+	if (shard_nr == 0) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "No shards of %s found in %s",
+			     basename, output_dir);
+		return FALSE;
+	}
+
+	/* add each one */
+	icons_dir = g_build_filename (temp_dir, "icons", NULL);
+	for (i = 1; i <= shard_nr; i++) {
+		_cleanup_free_ gchar *filename_icons = NULL;
+		_cleanup_free_ gchar *filename_xml = NULL;
+		filename_xml = g_strdup_printf ("%s/%s%u-of-%u.xml",
+						output_dir, prefix,
+						i, shard_nr);
+		if (!cra_context_load_shard (ctx, filename_xml, error))
+			return FALSE;
+		filename_icons = g_strdup_printf ("%s/%s%u-of-%u-icons.tar.gz",
+						  output_dir, prefix,
+						  i, shard_nr);
+		if (!cra_utils_explode (filename_icons, icons_dir, NULL, error))
+			return FALSE;
+	}
+	g_print ("Loaded %u shards\n", shard_nr);
+	return TRUE;
+}
+
+/**
+ * cra_main_app_sort_cb:
+ *
+ * Sorts by ID and then by package, with any extra applications first, so
+ * the merge picks the same applications however the packages were split.
+ */
+static gint
+cra_main_app_sort_cb (gconstpointer a, gconstpointer b)
+{
+	AsApp *app1 = *((AsApp **) a);
+	AsApp *app2 = *((AsApp **) b);
+	gint rc;
+
+	rc = g_strcmp0 (as_app_get_id_full (app1), as_app_get_id_full (app2));
+	if (rc != 0)
+		return rc;
+	if (!CRA_IS_APP (app1) || !CRA_IS_APP (app2))
+		return CRA_IS_APP (app1) - CRA_IS_APP (app2);
+	return g_strcmp0 (cra_app_get_package_nevr (CRA_APP (app1)),
+			  cra_app_get_package_nevr (CRA_APP (app2)));
+}
+
 /**
  * cra_context_disable_older_packages:
  */
@@ -605,6 +1478,10 @@ cra_main_find_in_cache (CraContext *ctx, const gchar *filename)
 					      cache_id);
 	if (apps->len == 0)
 		return FALSE;
+
+	/* skipped by every shard, but only added by one */
+	if (!cra_context_in_shard (ctx, filename))
+		return TRUE;
 	for (i = 0; i < apps->len; i++) {
 		app = g_ptr_array_index (apps, i);
 		cra_context_add_app (ctx, (CraApp *) app);
@@ -612,6 +1489,101 @@ cra_main_find_in_cache (CraContext *ctx, const gchar *filename)
 	return TRUE;
 }
 
+/**
+ * cra_main_size_cmp:
+ */
+static gint
+cra_main_size_cmp (gconstpointer a, gconstpointer b)
+{
+	guint64 size_a = *((const guint64 *) a);
+	guint64 size_b = *((const guint64 *) b);
+	if (size_a > size_b)
+		return -1;
+	if (size_a < size_b)
+		return 1;
+	return 0;
+}
+
+/**
+ * cra_main_get_auto_threads:
+ *
+ * Every worker can be exploding a package at the same time, so only use as
+ * many workers as the CPU quota allows while the largest packages could all
+ * be in flight at once without going over the memory limit. Each package is
+ * counted as what cra_task_reserve() reserves for it: the package read into
+ * memory, plus the files that are exploded from it, which are in memory too
+ * when the temp dir is a tmpfs.
+ */
+static guint
+cra_main_get_auto_threads (CraContext *ctx)
+{
+	CraPackage *pkg;
+	GStatBuf stat_buf;
+	guint64 limit;
+	guint64 size;
+	guint64 total = 0;
+	guint i;
+	guint nr_cpus;
+	guint nr_threads;
+	_cleanup_array_unref_ GArray *sizes = NULL;
+
+	nr_cpus = cra_utils_get_cpu_quota ();
+	limit = cra_utils_get_memory_limit ();
+
+	/* get the worst case footprint of each package */
+	sizes = g_array_new (FALSE, FALSE, sizeof (guint64));
+	for (i = 0; i < ctx->packages->len; i++) {
+		pkg = g_ptr_array_index (ctx->packages, i);
+		if (!cra_package_get_enabled (pkg))
+			continue;
+		if (!cra_context_in_shard (ctx, cra_package_get_filename (pkg)))
+			continue;
+		if (g_stat (cra_package_get_filename (pkg), &stat_buf) != 0)
+			continue;
+		size = (guint64) stat_buf.st_size +
+		       cra_package_get_explode_size (pkg, ctx->file_globs);
+		g_array_append_val (sizes, size);
+	}
+	g_array_sort (sizes, cra_main_size_cmp);
+
+	/* add workers until the largest packages no longer fit */
+	nr_threads = nr_cpus;
+	for (i = 0; i < sizes->len && i < nr_cpus; i++) {
+		total += g_array_index (sizes, guint64, i);
+		if (total > limit) {
+			nr_threads = MAX (i, 1);
+			break;
+		}
+	}
+	g_print ("Using %u threads (CPU quota %u, memory limit %"
+		 G_GUINT64_FORMAT " MiB)\n",
+		 nr_threads, nr_cpus, limit / (1024 * 1024));
+	return nr_threads;
+}
+
+/**
+ * cra_main_progress_cb:
+ */
+static gboolean
+cra_main_progress_cb (gpointer user_data)
+{
+	CraProgress *progress = (CraProgress *) user_data;
+	cra_progress_report (progress);
+	return G_SOURCE_CONTINUE;
+}
+
+/* how many of the slowest packages to show for each stage */
+#define CRA_MAIN_PROFILE_TOP_N		10
+
+/* what the coordinator is called in the memory report */
+#define CRA_MAIN_MEMORY_NAME		"(main)"
+
+/* how often to print the progress, in seconds */
+#define CRA_MAIN_PROGRESS_INTERVAL	5
+
+/* how long a worker process gets to give up by itself before being killed */
+#define CRA_MAIN_WATCHDOG_GRACE		30
+
 /**
  * main:
  */
@@ -622,10 +1594,14 @@ main (int argc, char **argv)
 	CraPackage *pkg;
 	CraTask *task;
 	GOptionContext *option_context;
-	GThreadPool *pool;
 	const gchar *filename;
 	gboolean add_cache_id = FALSE;
 	gboolean extra_checks = FALSE;
+	gboolean merge = FALSE;
+	gboolean journal = FALSE;
+	gboolean resume = FALSE;
+	gboolean log_archive = FALSE;
+	gboolean log_xml = FALSE;
 	gboolean no_net = FALSE;
 	gboolean ret;
 	gboolean use_package_cache = FALSE;
@@ -633,7 +1609,17 @@ main (int argc, char **argv)
 	gchar *temp_dir = NULL;
 	gchar *tmp;
 	gdouble api_version = 0.0f;
-	gint max_threads = 4;
+	guint max_threads = 0;
+	guint timeout;
+	guint progress_id;
+	gint worker_processes = 0;
+	guint shard_id = 0;
+	guint shard_nr = 0;
+	gint disk_budget = 0;
+	gint memory_budget = 0;
+	gint package_timeout = 0;
+	gint plugin_timeout = 0;
+	gint64 profile;
 	gint rc;
 	guint i;
 	_cleanup_dir_close_ GDir *dir = NULL;
@@ -644,13 +1630,20 @@ main (int argc, char **argv)
 	_cleanup_free_ gchar *extra_appstream = NULL;
 	_cleanup_free_ gchar *extra_screenshots = NULL;
 	_cleanup_free_ gchar *log_dir = NULL;
+	_cleanup_free_ gchar *max_threads_str = NULL;
 	_cleanup_free_ gchar *old_metadata = NULL;
 	_cleanup_free_ gchar *output_dir = NULL;
 	_cleanup_free_ gchar *packages_dir = NULL;
+	_cleanup_free_ gchar *metrics_file = NULL;
+	_cleanup_free_ gchar *progress_file = NULL;
+	_cleanup_free_ gchar *trace_file = NULL;
 	_cleanup_free_ gchar *screenshot_uri = NULL;
+	_cleanup_free_ gchar *shard = NULL;
+	_cleanup_free_ gchar *shard_basename = NULL;
 	_cleanup_object_unref_ GFile *old_metadata_file = NULL;
 	_cleanup_ptrarray_unref_ GPtrArray *packages = NULL;
 	_cleanup_ptrarray_unref_ GPtrArray *tasks = NULL;
+	_cleanup_ptrarray_unref_ GPtrArray *todo = NULL;
 	_cleanup_timer_destroy_ GTimer *timer = NULL;
 	const GOptionEntry options[] = {
 		{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
@@ -665,6 +1658,12 @@ main (int argc, char **argv)
 			"Add a cache ID to each component", NULL },
 		{ "log-dir", '\0', 0, G_OPTION_ARG_STRING, &log_dir,
 			"Set the logging directory       [default: ./logs]", NULL },
+		{ "log-archive", '\0', 0, G_OPTION_ARG_NONE, &log_archive,
+			"Write the package logs to one indexed archive", NULL },
+		{ "log-xml", '\0', 0, G_OPTION_ARG_NONE, &log_xml,
+			"Include the XML of each component in the logs", NULL },
+		{ "trace", '\0', 0, G_OPTION_ARG_STRING, &trace_file,
+			"Write a Chrome trace of each stage to a file", NULL },
 		{ "packages-dir", '\0', 0, G_OPTION_ARG_STRING, &packages_dir,
 			"Set the packages directory      [default: ./packages]", NULL },
 		{ "temp-dir", '\0', 0, G_OPTION_ARG_STRING, &temp_dir,
@@ -677,18 +1676,40 @@ main (int argc, char **argv)
 			"Use extra screenshots data      [default: ./screenshots-extra]", NULL },
 		{ "output-dir", '\0', 0, G_OPTION_ARG_STRING, &output_dir,
 			"Set the output directory        [default: .]", NULL },
-		{ "cache-dir", '\0', 0, G_OPTION_ARG_STRING, &output_dir,
+		{ "cache-dir", '\0', 0, G_OPTION_ARG_STRING, &cache_dir,
 			"Set the cache directory         [default: ./cache]", NULL },
 		{ "basename", '\0', 0, G_OPTION_ARG_STRING, &basename,
 			"Set the origin name             [default: fedora-21]", NULL },
-		{ "max-threads", '\0', 0, G_OPTION_ARG_INT, &max_threads,
-			"Set the number of threads       [default: 4]", NULL },
+		{ "max-threads", '\0', 0, G_OPTION_ARG_STRING, &max_threads_str,
+			"Set the thread count or 'auto'  [default: auto]", NULL },
+		{ "worker-processes", '\0', 0, G_OPTION_ARG_INT, &worker_processes,
+			"Set the number of processes     [default: none]", NULL },
+		{ "disk-budget", '\0', 0, G_OPTION_ARG_INT, &disk_budget,
+			"Set the temp space budget (MiB) [default: unlimited]", NULL },
+		{ "memory-budget", '\0', 0, G_OPTION_ARG_INT, &memory_budget,
+			"Set the memory budget (MiB)     [default: unlimited]", NULL },
+		{ "package-timeout", '\0', 0, G_OPTION_ARG_INT, &package_timeout,
+			"Abandon packages after (secs)   [default: never]", NULL },
+		{ "plugin-timeout", '\0', 0, G_OPTION_ARG_INT, &plugin_timeout,
+			"Abandon plugins after (secs)    [default: never]", NULL },
 		{ "api-version", '\0', 0, G_OPTION_ARG_DOUBLE, &api_version,
 			"Set the AppStream version       [default: 0.4]", NULL },
 		{ "screenshot-uri", '\0', 0, G_OPTION_ARG_STRING, &screenshot_uri,
 			"Set the screenshot base URL     [default: none]", NULL },
 		{ "old-metadata", '\0', 0, G_OPTION_ARG_STRING, &old_metadata,
 			"Set the old metadata location   [default: none]", NULL },
+		{ "shard", '\0', 0, G_OPTION_ARG_STRING, &shard,
+			"Only process shard I/N          [default: none]", NULL },
+		{ "merge", '\0', 0, G_OPTION_ARG_NONE, &merge,
+			"Merge the output of all the shards", NULL },
+		{ "journal", '\0', 0, G_OPTION_ARG_NONE, &journal,
+			"Record packages so the run can be resumed", NULL },
+		{ "resume", '\0', 0, G_OPTION_ARG_NONE, &resume,
+			"Skip packages done by an interrupted run", NULL },
+		{ "progress-file", '\0', 0, G_OPTION_ARG_STRING, &progress_file,
+			"Write progress as JSON lines    [default: none]", NULL },
+		{ "metrics-file", '\0', 0, G_OPTION_ARG_STRING, &metrics_file,
+			"Write Prometheus metrics        [default: none]", NULL },
 		{ NULL}
 	};
 
@@ -705,12 +1726,33 @@ main (int argc, char **argv)
 	if (extra_checks)
 		g_setenv ("CRA_PERFORM_EXTRA_CHECKS", "1", TRUE);
 
-#if !GLIB_CHECK_VERSION(2,40,0)
-	if (max_threads > 1) {
-		g_debug ("O_CLOEXEC not available, using 1 core");
-		max_threads = 1;
+	/* zero means work it out after scanning the packages */
+	if (max_threads_str != NULL &&
+	    g_strcmp0 (max_threads_str, "auto") != 0) {
+		guint64 tmp = 0;
+		gchar *endptr = NULL;
+		if (g_ascii_isdigit (max_threads_str[0]))
+			tmp = g_ascii_strtoull (max_threads_str, &endptr, 10);
+		if (tmp == 0 || tmp > 1024 || endptr == NULL || *endptr != '\0') {
+			g_print ("Invalid thread count: %s\n", max_threads_str);
+			goto out;
+		}
+		max_threads = tmp;
 	}
-#endif
+
+	/* only process part of the packages */
+	if (shard != NULL) {
+		if (sscanf (shard, "%u/%u", &shard_id, &shard_nr) != 2 ||
+		    shard_id == 0 || shard_id > shard_nr) {
+			g_print ("Invalid shard: %s\n", shard);
+			goto out;
+		}
+		if (merge) {
+			g_print ("Cannot use --shard with --merge\n");
+			goto out;
+		}
+	}
+
 	/* set defaults */
 	if (api_version < 0.01)
 		api_version = 0.41;
@@ -726,6 +1768,10 @@ main (int argc, char **argv)
 		cache_dir = g_strdup ("./cache");
 	if (basename == NULL)
 		basename = g_strdup ("fedora-21");
+	if (shard_nr > 0) {
+		shard_basename = g_strdup_printf ("%s-shard-%u-of-%u",
+						  basename, shard_id, shard_nr);
+	}
 	if (screenshot_uri == NULL)
 		screenshot_uri = g_strdup ("http://alt.fedoraproject.org/pub/alt/screenshots/f21/");
 	if (extra_appstream == NULL)
@@ -736,6 +1782,15 @@ main (int argc, char **argv)
 		extra_screenshots = g_strdup ("./screenshots-extra");
 	setlocale (LC_ALL, "");
 
+	/* this has to be open before the workers are forked */
+	if (trace_file != NULL &&
+	    !cra_profile_open_trace (trace_file, &error)) {
+		g_warning ("failed to open trace: %s", error->message);
+		goto out;
+	}
+	if (metrics_file != NULL)
+		cra_metrics_set_filename (metrics_file);
+
 	/* set up state */
 	if (use_package_cache) {
 		rc = g_mkdir_with_parents (temp_dir, 0700);
@@ -820,6 +1875,38 @@ main (int argc, char **argv)
 	ctx->use_package_cache = use_package_cache;
 	ctx->api_version = api_version;
 	ctx->add_cache_id = add_cache_id;
+	ctx->log_xml = log_xml;
+	ctx->shard_id = shard_id;
+	ctx->shard_nr = shard_nr;
+
+	/* record each package as it finishes, which syncs to disk each time
+	 * so is only done when asked for */
+	if (!merge && (journal || resume)) {
+		tmp = g_strdup_printf ("%s/%s.journal", cache_dir,
+				       shard_basename != NULL ? shard_basename : basename);
+		ctx->journal = cra_journal_open (tmp, resume, &error);
+		g_free (tmp);
+		if (ctx->journal == NULL) {
+			g_warning ("failed to open journal: %s", error->message);
+			goto out;
+		}
+	}
+	if (!merge) {
+		tmp = NULL;
+		if (log_archive)
+			tmp = shard_basename != NULL ? shard_basename : basename;
+		ctx->log_sink = cra_log_sink_new (log_dir, tmp, resume, &error);
+		if (ctx->log_sink == NULL) {
+			g_warning ("failed to open log sink: %s", error->message);
+			goto out;
+		}
+	}
+	ctx->progress = cra_progress_new (CRA_MAIN_PROGRESS_INTERVAL);
+	if (progress_file != NULL &&
+	    !cra_progress_set_filename (ctx->progress, progress_file, &error)) {
+		g_warning ("failed to open progress file: %s", error->message);
+		goto out;
+	}
 	ctx->file_globs = cra_plugin_loader_get_globs (ctx->plugins);
 
 	/* add old metadata */
@@ -835,21 +1922,10 @@ main (int argc, char **argv)
 		}
 	}
 
-	/* create thread pool */
-	pool = g_thread_pool_new (cra_task_process_func,
-				  ctx,
-				  max_threads,
-				  TRUE,
-				  &error);
-	if (pool == NULL) {
-		g_warning ("failed to set up pool: %s", error->message);
-		goto out;
-	}
-
-	/* add any extra applications */
-	if (extra_appstream != NULL &&
+	/* add any extra applications, unless we are only a shard */
+	if (shard_nr == 0 && extra_appstream != NULL &&
 	    g_file_test (extra_appstream, G_FILE_TEST_EXISTS)) {
-		ret = cra_utils_add_apps_from_dir (&ctx->apps,
+		ret = cra_utils_add_apps_from_dir (ctx->store,
 						   extra_appstream,
 						   &error);
 		if (!ret) {
@@ -857,12 +1933,22 @@ main (int argc, char **argv)
 				   error->message);
 			goto out;
 		}
-		g_print ("Added extra %i apps\n", g_list_length (ctx->apps));
+		g_print ("Added extra %i apps\n", cra_store_get_size (ctx->store));
 	}
 
 	/* scan each package */
 	packages = g_ptr_array_new_with_free_func (g_free);
-	if (argc == 1) {
+	if (merge) {
+		ret = cra_context_load_shards (ctx,
+					       temp_dir,
+					       output_dir,
+					       basename,
+					       &error);
+		if (!ret) {
+			g_warning ("failed to load shards: %s", error->message);
+			goto out;
+		}
+	} else if (argc == 1) {
 		dir = g_dir_open (packages_dir, 0, &error);
 		if (dir == NULL) {
 			g_warning ("failed to open packages: %s", error->message);
@@ -878,6 +1964,7 @@ main (int argc, char **argv)
 			g_ptr_array_add (packages, g_strdup (argv[i]));
 	}
 	g_print ("Scanning packages...\n");
+	cra_memory_sample (CRA_MAIN_MEMORY_NAME, "scan");
 	timer = g_timer_new ();
 	for (i = 0; i < packages->len; i++) {
 		filename = g_ptr_array_index (packages, i);
@@ -895,6 +1982,7 @@ main (int argc, char **argv)
 			g_warning ("%s", error->message);
 			goto out;
 		}
+		cra_progress_add (ctx->progress, CRA_PROGRESS_COUNTER_SCANNED, 1);
 		if (g_timer_elapsed (timer, NULL) > 3.f) {
 			g_print ("Parsed %i/%i files...\n",
 				 i, packages->len);
@@ -905,17 +1993,56 @@ main (int argc, char **argv)
 	/* disable anything not newest */
 	cra_context_disable_older_packages (ctx);
 
+	/* create workers */
+	if (worker_processes > 0) {
+		/* each worker only runs one package at a time, so the
+		 * budgets are kept by the coordinator */
+		ctx->governor = cra_governor_new (0, 0);
+		ctx->worker_governor = cra_governor_new ((guint64) MAX (disk_budget, 0) * 1024 * 1024,
+							 (guint64) MAX (memory_budget, 0) * 1024 * 1024);
+	} else {
+		ctx->governor = cra_governor_new ((guint64) MAX (disk_budget, 0) * 1024 * 1024,
+						  (guint64) MAX (memory_budget, 0) * 1024 * 1024);
+	}
+	if (package_timeout > 0 || plugin_timeout > 0) {
+		ctx->watchdog = cra_watchdog_new (MAX (package_timeout, 0),
+						  MAX (plugin_timeout, 0));
+	}
+	if (worker_processes > 0) {
+		/* these have to be forked before any threads exist */
+		g_print ("Using %i worker processes\n", worker_processes);
+	} else {
+		if (max_threads == 0)
+			max_threads = cra_main_get_auto_threads (ctx);
+#if !GLIB_CHECK_VERSION(2,40,0)
+		if (max_threads > 1) {
+			g_debug ("O_CLOEXEC not available, using 1 core");
+			max_threads = 1;
+		}
+#endif
+		ctx->executor = cra_executor_new (max_threads, &error);
+		if (ctx->executor == NULL) {
+			g_warning ("failed to set up workers: %s",
+				   error->message);
+			goto out;
+		}
+	}
+
 	/* add each package */
 	g_print ("Processing packages...\n");
+	cra_memory_sample (CRA_MAIN_MEMORY_NAME, "process");
 	tasks = g_ptr_array_new_with_free_func ((GDestroyNotify) cra_task_free);
+	todo = g_ptr_array_new ();
 	for (i = 0; i < ctx->packages->len; i++) {
 		pkg = g_ptr_array_index (ctx->packages, i);
+		if (!cra_context_in_shard (ctx, cra_package_get_filename (pkg)))
+			continue;
 		if (!cra_package_get_enabled (pkg)) {
 			cra_package_log (pkg,
 					 CRA_PACKAGE_LOG_LEVEL_DEBUG,
 					 "%s is not enabled",
 					 cra_package_get_nevr (pkg));
-			cra_package_log_flush (pkg, NULL);
+			cra_context_flush_log (ctx, pkg);
 			continue;
 		}
 
@@ -930,44 +2057,129 @@ main (int argc, char **argv)
 
 		/* create task */
 		task = g_new0 (CraTask, 1);
+		task->ctx = ctx;
 		task->plugins_to_run = g_ptr_array_new ();
+		task->apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 		task->id = i;
 		task->filename = g_strdup (cra_package_get_filename (pkg));
 		task->tmpdir = g_build_filename (temp_dir, cra_package_get_nevr (pkg), NULL);
 		task->pkg = g_object_ref (pkg);
 		g_ptr_array_add (tasks, task);
 
-		/* add task to pool */
-		ret = g_thread_pool_push (pool, task, &error);
+		/* already done by the interrupted run */
+		if (cra_task_restore (task))
+			continue;
+
+		/* add task to the workers */
+		g_ptr_array_add (todo, task);
+	}
+	if (ctx->journal != NULL && resume) {
+		g_print ("Resumed %u packages from the journal\n",
+			 tasks->len - todo->len);
+	}
+	cra_progress_set_total (ctx->progress, todo->len);
+
+	/* wait for them to finish */
+	if (ctx->executor != NULL) {
+		cra_progress_start (ctx->progress);
+		if (ctx->log_sink != NULL)
+			cra_log_sink_start (ctx->log_sink);
+		for (i = 0; i < todo->len; i++) {
+			task = g_ptr_array_index (todo, i);
+			cra_executor_push (ctx->executor, cra_task_run_func, task);
+		}
+		cra_executor_wait (ctx->executor);
+		cra_executor_print_stats (ctx->executor);
+	} else {
+		/* a thread cannot be used before the workers are forked */
+		progress_id = g_timeout_add_seconds (CRA_MAIN_PROGRESS_INTERVAL,
+						     cra_main_progress_cb,
+						     ctx->progress);
+
+		/* give the task a chance to give up by itself first */
+		timeout = 0;
+		if (package_timeout > 0)
+			timeout = package_timeout + CRA_MAIN_WATCHDOG_GRACE;
+		ret = cra_worker_pool_run (worker_processes,
+					   todo->len,
+					   timeout,
+					   cra_task_worker_func,
+					   cra_task_worker_result_func,
+					   cra_task_worker_admit_func,
+					   todo,
+					   &error);
+		g_source_remove (progress_id);
 		if (!ret) {
-			cra_package_log (task->pkg,
-					 CRA_PACKAGE_LOG_LEVEL_WARNING,
-					 "failed to set up pool: %s",
-					 error->message);
+			g_warning ("failed to run worker processes: %s",
+				   error->message);
 			goto out;
 		}
 	}
+	cra_progress_free (ctx->progress);
+	ctx->progress = NULL;
+	cra_profile_report (CRA_MAIN_PROFILE_TOP_N);
+	if (ctx->log_sink != NULL &&
+	    !cra_log_sink_close (ctx->log_sink, &error)) {
+		g_warning ("failed to write logs: %s", error->message);
+		goto out;
+	}
+	cra_context_add_task_results (ctx, tasks);
+
+	/* leave the merge until all the shards have finished */
+	if (shard_nr > 0) {
+		cra_memory_sample (CRA_MAIN_MEMORY_NAME, "write");
+		profile = cra_profile_start ();
+		ret = cra_context_write_shard (ctx, output_dir,
+					       shard_basename, &error);
+		cra_profile_stop (profile, NULL, "write-xml", NULL);
+		if (!ret) {
+			g_warning ("Failed to write shard: %s", error->message);
+			goto out;
+		}
+		profile = cra_profile_start ();
+		ret = cra_context_write_icons (ctx,
+					       temp_dir,
+					       output_dir,
+					       shard_basename,
+					       &error);
+		cra_profile_stop (profile, NULL, "write-icons", NULL);
+		if (!ret) {
+			g_warning ("Failed to write icons archive: %s",
+				   error->message);
+			goto out;
+		}
+		g_print ("Done!\n");
+		goto out;
+	}
 
-	/* wait for them to finish */
-	g_thread_pool_free (pool, FALSE, TRUE);
-
-	/* merge */
+	/* merge the shards in the same order however the packages were
+	 * split, but otherwise keep the order the packages were found in */
 	g_print ("Merging applications...\n");
-	cra_plugin_loader_merge (ctx->plugins, &ctx->apps);
+	cra_memory_sample (CRA_MAIN_MEMORY_NAME, "merge");
+	if (merge)
+		cra_store_sort (ctx->store, cra_main_app_sort_cb);
+	profile = cra_profile_start ();
+	cra_plugin_loader_merge (ctx->plugins, ctx->store);
+	cra_profile_stop (profile, NULL, "merge", NULL);
 
 	/* write XML file */
+	cra_memory_sample (CRA_MAIN_MEMORY_NAME, "write");
+	profile = cra_profile_start ();
 	ret = cra_context_write_xml (ctx, output_dir, basename, &error);
+	cra_profile_stop (profile, NULL, "write-xml", NULL);
 	if (!ret) {
 		g_warning ("Failed to write XML file: %s", error->message);
 		goto out;
 	}
 
 	/* write icons archive */
+	profile = cra_profile_start ();
 	ret = cra_context_write_icons (ctx,
 				       temp_dir,
 				       output_dir,
 				       basename,
 				       &error);
+	cra_profile_stop (profile, NULL, "write-icons", NULL);
 	if (!ret) {
 		g_warning ("Failed to write icons archive: %s", error->message);
 		goto out;
@@ -976,6 +2188,12 @@ main (int argc, char **argv)
 	/* success */
 	g_print ("Done!\n");
 out:
+	g_clear_error (&error);
+	if (!cra_metrics_write (&error))
+		g_warning ("failed to write metrics: %s", error->message);
+	cra_memory_sample (CRA_MAIN_MEMORY_NAME, NULL);
+	cra_memory_report (CRA_MAIN_PROFILE_TOP_N);
+	cra_profile_close_trace ();
 	g_option_context_free (option_context);
 	if (ctx != NULL)
 		cra_context_free (ctx);
@@ -0,0 +1,436 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+
+#include "cra-cleanup.h"
+#include "cra-memory.h"
+
+typedef struct {
+	gchar		*name;
+	gint64		 current;		/* in bytes, only for allocations */
+	guint64		 peak;			/* in bytes */
+	guint64		 total;			/* in bytes */
+	guint		 calls;
+} CraMemoryEntry;
+
+typedef struct {
+	const gchar	*stage;			/* static */
+	guint64		 rss;			/* at the start of the stage */
+} CraMemoryOpen;
+
+typedef struct {
+	gchar		*kind;
+	gint64		 bytes;
+} CraMemoryObject;
+
+typedef enum {
+	CRA_MEMORY_TABLE_STAGE,
+	CRA_MEMORY_TABLE_PACKAGE,
+	CRA_MEMORY_TABLE_ALLOC,
+	CRA_MEMORY_TABLE_LAST
+} CraMemoryTable;
+
+static const gchar *cra_memory_table_names[] = {
+	"stage", "package", "alloc", NULL };
+
+static GMutex		 cra_memory_mutex;	/* for the tables */
+static GHashTable	*cra_memory_tables[CRA_MEMORY_TABLE_LAST];
+static GHashTable	*cra_memory_open = NULL;
+
+/**
+ * cra_memory_enabled:
+ *
+ * Memory accounting is turned on by setting CRA_PROFILE_MEMORY, which is
+ * only looked at once.
+ */
+gboolean
+cra_memory_enabled (void)
+{
+	static gsize once = 0;
+	static gboolean enabled = FALSE;
+
+	if (g_once_init_enter (&once)) {
+		enabled = g_getenv ("CRA_PROFILE_MEMORY") != NULL;
+		g_once_init_leave (&once, 1);
+	}
+	return enabled;
+}
+
+/**
+ * cra_memory_get_rss:
+ *
+ * Returns the resident set size in bytes, or 0 if it is not known.
+ */
+static guint64
+cra_memory_get_rss (void)
+{
+	guint64 pages;
+	gchar *endptr;
+	_cleanup_free_ gchar *data = NULL;
+
+	if (!g_file_get_contents ("/proc/self/statm", &data, NULL, NULL))
+		return 0;
+
+	/* the first value is the size, the second the resident pages */
+	g_ascii_strtoull (data, &endptr, 10);
+	pages = g_ascii_strtoull (endptr, NULL, 10);
+	return pages * sysconf (_SC_PAGESIZE);
+}
+
+/**
+ * cra_memory_entry_free:
+ */
+static void
+cra_memory_entry_free (CraMemoryEntry *entry)
+{
+	g_free (entry->name);
+	g_free (entry);
+}
+
+/**
+ * cra_memory_get_entry:
+ *
+ * Must be called with cra_memory_mutex held.
+ */
+static CraMemoryEntry *
+cra_memory_get_entry (CraMemoryTable table, const gchar *name)
+{
+	CraMemoryEntry *entry;
+	guint i;
+
+	if (cra_memory_tables[0] == NULL) {
+		for (i = 0; i < CRA_MEMORY_TABLE_LAST; i++) {
+			cra_memory_tables[i] =
+				g_hash_table_new_full (g_str_hash, g_str_equal,
+						       NULL, (GDestroyNotify) cra_memory_entry_free);
+		}
+		cra_memory_open = g_hash_table_new_full (g_str_hash, g_str_equal,
+							 g_free, g_free);
+	}
+	entry = g_hash_table_lookup (cra_memory_tables[table], name);
+	if (entry == NULL) {
+		entry = g_new0 (CraMemoryEntry, 1);
+		entry->name = g_strdup (name);
+		g_hash_table_insert (cra_memory_tables[table], entry->name, entry);
+	}
+	return entry;
+}
+
+/**
+ * cra_memory_sample:
+ *
+ * Samples the RSS as @name enters @stage, or finishes if @stage is %NULL.
+ * The growth since the last sample of @name is added to the stage it was
+ * in, which includes anything other threads did at the same time, so the
+ * allocations that matter are also counted with cra_memory_add().
+ */
+void
+cra_memory_sample (const gchar *name, const gchar *stage)
+{
+	CraMemoryEntry *entry;
+	CraMemoryOpen *open;
+	guint64 rss;
+
+	if (!cra_memory_enabled () || name == NULL)
+		return;
+	rss = cra_memory_get_rss ();
+	if (rss == 0)
+		return;
+
+	g_mutex_lock (&cra_memory_mutex);
+	entry = cra_memory_get_entry (CRA_MEMORY_TABLE_PACKAGE, name);
+	entry->peak = MAX (entry->peak, rss);
+	entry->calls++;
+
+	/* close the last stage */
+	open = g_hash_table_lookup (cra_memory_open, name);
+	if (open != NULL) {
+		entry = cra_memory_get_entry (CRA_MEMORY_TABLE_STAGE, open->stage);
+		if (rss > open->rss) {
+			entry->peak = MAX (entry->peak, rss - open->rss);
+			entry->total += rss - open->rss;
+		}
+		entry->calls++;
+	}
+	if (stage == NULL) {
+		g_hash_table_remove (cra_memory_open, name);
+		goto out;
+	}
+	if (open == NULL) {
+		open = g_new0 (CraMemoryOpen, 1);
+		g_hash_table_insert (cra_memory_open, g_strdup (name), open);
+	}
+	open->stage = stage;
+	open->rss = rss;
+out:
+	g_mutex_unlock (&cra_memory_mutex);
+}
+
+/**
+ * cra_memory_add:
+ *
+ * Counts an allocation of @bytes of @kind, or a free if @bytes is negative.
+ */
+void
+cra_memory_add (const gchar *kind, gint64 bytes)
+{
+	CraMemoryEntry *entry;
+
+	if (!cra_memory_enabled ())
+		return;
+	g_mutex_lock (&cra_memory_mutex);
+	entry = cra_memory_get_entry (CRA_MEMORY_TABLE_ALLOC, kind);
+	entry->current += bytes;
+	if (bytes > 0) {
+		entry->total += bytes;
+		entry->calls++;
+	}
+	if (entry->current > 0)
+		entry->peak = MAX (entry->peak, (guint64) entry->current);
+	g_mutex_unlock (&cra_memory_mutex);
+}
+
+/**
+ * cra_memory_object_notify_cb:
+ */
+static void
+cra_memory_object_notify_cb (gpointer data, GObject *where_the_object_was)
+{
+	CraMemoryObject *obj = (CraMemoryObject *) data;
+	cra_memory_add (obj->kind, -obj->bytes);
+	g_free (obj->kind);
+	g_free (obj);
+}
+
+/**
+ * cra_memory_add_pixbuf:
+ *
+ * Counts the pixel data of @pixbuf as @kind until it is finalized.
+ */
+void
+cra_memory_add_pixbuf (const gchar *kind, GdkPixbuf *pixbuf)
+{
+	CraMemoryObject *obj;
+
+	if (!cra_memory_enabled () || pixbuf == NULL)
+		return;
+	obj = g_new0 (CraMemoryObject, 1);
+	obj->kind = g_strdup (kind);
+	obj->bytes = (gint64) gdk_pixbuf_get_rowstride (pixbuf) *
+		     gdk_pixbuf_get_height (pixbuf);
+	cra_memory_add (obj->kind, obj->bytes);
+	g_object_weak_ref (G_OBJECT (pixbuf), cra_memory_object_notify_cb, obj);
+}
+
+/**
+ * cra_memory_reset:
+ *
+ * Forgets everything apart from what is still allocated.
+ */
+void
+cra_memory_reset (void)
+{
+	CraMemoryEntry *entry;
+	GHashTableIter iter;
+
+	g_mutex_lock (&cra_memory_mutex);
+	if (cra_memory_tables[0] == NULL)
+		goto out;
+	g_hash_table_remove_all (cra_memory_tables[CRA_MEMORY_TABLE_STAGE]);
+	g_hash_table_remove_all (cra_memory_tables[CRA_MEMORY_TABLE_PACKAGE]);
+	g_hash_table_remove_all (cra_memory_open);
+	g_hash_table_iter_init (&iter, cra_memory_tables[CRA_MEMORY_TABLE_ALLOC]);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+		entry->peak = MAX (entry->current, 0);
+		entry->total = 0;
+		entry->calls = 0;
+	}
+out:
+	g_mutex_unlock (&cra_memory_mutex);
+}
+
+/**
+ * cra_memory_to_string:
+ *
+ * Saves the accounting so that a worker process can send it back to the
+ * coordinator, which adds it with cra_memory_add_from_string().
+ */
+GString *
+cra_memory_to_string (void)
+{
+	CraMemoryEntry *entry;
+	GHashTableIter iter;
+	GString *str;
+	guint i;
+
+	str = g_string_new (NULL);
+	g_mutex_lock (&cra_memory_mutex);
+	if (cra_memory_tables[0] == NULL)
+		goto out;
+	for (i = 0; i < CRA_MEMORY_TABLE_LAST; i++) {
+		g_hash_table_iter_init (&iter, cra_memory_tables[i]);
+		while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+			g_string_append_printf (str, "%s\t%s\t%" G_GUINT64_FORMAT
+						"\t%" G_GUINT64_FORMAT "\t%u\n",
+						cra_memory_table_names[i],
+						entry->name,
+						entry->peak,
+						entry->total,
+						entry->calls);
+		}
+	}
+out:
+	g_mutex_unlock (&cra_memory_mutex);
+	return str;
+}
+
+/**
+ * cra_memory_add_from_string:
+ */
+void
+cra_memory_add_from_string (const gchar *data, gsize len)
+{
+	CraMemoryEntry *entry;
+	guint i;
+	guint j;
+	_cleanup_free_ gchar *tmp = NULL;
+	_cleanup_strv_free_ gchar **lines = NULL;
+
+	tmp = g_strndup (data, len);
+	lines = g_strsplit (tmp, "\n", -1);
+	g_mutex_lock (&cra_memory_mutex);
+	for (i = 0; lines[i] != NULL; i++) {
+		_cleanup_strv_free_ gchar **split = NULL;
+		split = g_strsplit (lines[i], "\t", -1);
+		if (g_strv_length (split) != 5)
+			continue;
+		for (j = 0; j < CRA_MEMORY_TABLE_LAST; j++) {
+			if (g_strcmp0 (split[0], cra_memory_table_names[j]) == 0)
+				break;
+		}
+		if (j == CRA_MEMORY_TABLE_LAST)
+			continue;
+		entry = cra_memory_get_entry (j, split[1]);
+		entry->peak = MAX (entry->peak,
+				   g_ascii_strtoull (split[2], NULL, 10));
+		entry->total += g_ascii_strtoull (split[3], NULL, 10);
+		entry->calls += g_ascii_strtoull (split[4], NULL, 10);
+	}
+	g_mutex_unlock (&cra_memory_mutex);
+}
+
+/**
+ * cra_memory_entry_cmp:
+ */
+static gint
+cra_memory_entry_cmp (gconstpointer a, gconstpointer b)
+{
+	CraMemoryEntry *entry_a = *((CraMemoryEntry **) a);
+	CraMemoryEntry *entry_b = *((CraMemoryEntry **) b);
+	if (entry_a->peak > entry_b->peak)
+		return -1;
+	if (entry_a->peak < entry_b->peak)
+		return 1;
+	return 0;
+}
+
+/**
+ * cra_memory_get_entries:
+ *
+ * Returns the entries in @table, largest peak first.
+ */
+static GPtrArray *
+cra_memory_get_entries (CraMemoryTable table)
+{
+	CraMemoryEntry *entry;
+	GHashTableIter iter;
+	GPtrArray *entries;
+
+	entries = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, cra_memory_tables[table]);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+		g_ptr_array_add (entries, entry);
+	g_ptr_array_sort (entries, cra_memory_entry_cmp);
+	return entries;
+}
+
+#define CRA_MEMORY_MIB(bytes)	((gdouble) (bytes) / (1024 * 1024))
+
+/**
+ * cra_memory_report:
+ *
+ * Prints how much the RSS grew in each stage, the peak and total size of
+ * each kind of counted allocation and the @top_n packages with the
+ * largest peak RSS.
+ */
+void
+cra_memory_report (guint top_n)
+{
+	CraMemoryEntry *entry;
+	guint i;
+	_cleanup_ptrarray_unref_ GPtrArray *allocs = NULL;
+	_cleanup_ptrarray_unref_ GPtrArray *packages = NULL;
+	_cleanup_ptrarray_unref_ GPtrArray *stages = NULL;
+
+	if (!cra_memory_enabled ())
+		return;
+	g_mutex_lock (&cra_memory_mutex);
+	if (cra_memory_tables[0] == NULL)
+		goto out;
+	stages = cra_memory_get_entries (CRA_MEMORY_TABLE_STAGE);
+	allocs = cra_memory_get_entries (CRA_MEMORY_TABLE_ALLOC);
+	packages = cra_memory_get_entries (CRA_MEMORY_TABLE_PACKAGE);
+
+	g_print ("\n%-32s %12s %12s %8s\n",
+		 "Stage", "MaxGrow/MiB", "Growth/MiB", "Calls");
+	for (i = 0; i < stages->len; i++) {
+		entry = g_ptr_array_index (stages, i);
+		g_print ("%-32s %12.1f %12.1f %8u\n",
+			 entry->name,
+			 CRA_MEMORY_MIB (entry->peak),
+			 CRA_MEMORY_MIB (entry->total),
+			 entry->calls);
+	}
+
+	g_print ("\n%-32s %12s %12s %8s\n",
+		 "Allocation", "Peak/MiB", "Total/MiB", "Count");
+	for (i = 0; i < allocs->len; i++) {
+		entry = g_ptr_array_index (allocs, i);
+		g_print ("%-32s %12.1f %12.1f %8u\n",
+			 entry->name,
+			 CRA_MEMORY_MIB (entry->peak),
+			 CRA_MEMORY_MIB (entry->total),
+			 entry->calls);
+	}
+
+	/* where the OOM killer is going to strike */
+	g_print ("\nLargest peak RSS:\n");
+	for (i = 0; i < packages->len && i < top_n; i++) {
+		entry = g_ptr_array_index (packages, i);
+		g_print (" %10.1fMiB  %s\n",
+			 CRA_MEMORY_MIB (entry->peak), entry->name);
+	}
+out:
+	g_mutex_unlock (&cra_memory_mutex);
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_MEMORY_H
+#define __CRA_MEMORY_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+gboolean	 cra_memory_enabled			(void);
+void		 cra_memory_sample			(const gchar	*name,
+							 const gchar	*stage);
+void		 cra_memory_add				(const gchar	*kind,
+							 gint64		 bytes);
+void		 cra_memory_add_pixbuf			(const gchar	*kind,
+							 GdkPixbuf	*pixbuf);
+void		 cra_memory_reset			(void);
+GString		*cra_memory_to_string			(void);
+void		 cra_memory_add_from_string		(const gchar	*data,
+							 gsize		 len);
+void		 cra_memory_report			(guint		 top_n);
+
+G_END_DECLS
+
+#endif /* __CRA_MEMORY_H */
@@ -0,0 +1,399 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "cra-cleanup.h"
+#include "cra-metrics.h"
+
+typedef enum {
+	CRA_METRIC_KIND_COUNTER,
+	CRA_METRIC_KIND_GAUGE,
+	CRA_METRIC_KIND_HISTOGRAM
+} CraMetricKind;
+
+typedef struct {
+	const gchar	*name;
+	CraMetricKind	 kind;
+	const gchar	*label;			/* or %NULL */
+	const gchar	*help;
+} CraMetricInfo;
+
+static const CraMetricInfo cra_metrics_info[] = {
+	{ "createrepo_as_packages_total", CRA_METRIC_KIND_COUNTER, "stage",
+	  "Packages that got to each stage" },
+	{ "createrepo_as_apps_total", CRA_METRIC_KIND_COUNTER, "result",
+	  "Applications accepted or vetoed" },
+	{ "createrepo_as_vetos_total", CRA_METRIC_KIND_COUNTER, "reason",
+	  "Reasons for applications being vetoed" },
+	{ "createrepo_as_stage_seconds", CRA_METRIC_KIND_HISTOGRAM, "stage",
+	  "Time spent in each stage and plugin" },
+	{ "createrepo_as_screenshot_cache_total", CRA_METRIC_KIND_COUNTER, "result",
+	  "Screenshots found in the download cache" },
+	{ "createrepo_as_extracted_bytes_total", CRA_METRIC_KIND_COUNTER, NULL,
+	  "Bytes extracted from packages" },
+	{ "createrepo_as_written_bytes_total", CRA_METRIC_KIND_COUNTER, "kind",
+	  "Bytes of icons and screenshots written" },
+	{ "createrepo_as_queue_depth", CRA_METRIC_KIND_GAUGE, NULL,
+	  "Jobs waiting for a worker thread" },
+	{ "createrepo_as_elapsed_seconds", CRA_METRIC_KIND_GAUGE, NULL,
+	  "Time since processing started" },
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (cra_metrics_info) == CRA_METRIC_LAST);
+
+/* in seconds, the +Inf bucket is the count */
+static const gdouble cra_metrics_buckets[] = {
+	0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60 };
+
+#define CRA_METRICS_BUCKETS		G_N_ELEMENTS (cra_metrics_buckets)
+
+typedef struct {
+	gdouble		 value;			/* or the sum for a histogram */
+	guint64		 count;
+	guint64		 buckets[CRA_METRICS_BUCKETS];	/* not cumulative */
+} CraMetricsValue;
+
+static GMutex		 cra_metrics_mutex;	/* for cra_metrics_values */
+static gchar		*cra_metrics_filename = NULL;
+static GHashTable	*cra_metrics_values[CRA_METRIC_LAST];
+static gint		 cra_metrics_counts[CRA_METRIC_LAST];	/* atomic */
+static gint		 cra_metrics_counts_set[CRA_METRIC_LAST];	/* atomic */
+
+/**
+ * cra_metrics_set_filename:
+ *
+ * Turns on collecting metrics, which are written to @filename in the
+ * Prometheus text format. This has to be called before any worker
+ * processes are forked.
+ */
+void
+cra_metrics_set_filename (const gchar *filename)
+{
+	g_free (cra_metrics_filename);
+	cra_metrics_filename = g_strdup (filename);
+}
+
+/**
+ * cra_metrics_enabled:
+ */
+gboolean
+cra_metrics_enabled (void)
+{
+	return cra_metrics_filename != NULL;
+}
+
+/**
+ * cra_metrics_get_value:
+ *
+ * Must be called with cra_metrics_mutex held.
+ */
+static CraMetricsValue *
+cra_metrics_get_value (CraMetric metric, const gchar *label)
+{
+	CraMetricsValue *value;
+
+	if (label == NULL)
+		label = "";
+	if (cra_metrics_values[metric] == NULL) {
+		cra_metrics_values[metric] =
+			g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, g_free);
+	}
+	value = g_hash_table_lookup (cra_metrics_values[metric], label);
+	if (value == NULL) {
+		value = g_new0 (CraMetricsValue, 1);
+		g_hash_table_insert (cra_metrics_values[metric],
+				     g_strdup (label), value);
+	}
+	return value;
+}
+
+/**
+ * cra_metrics_add:
+ */
+void
+cra_metrics_add (CraMetric metric, const gchar *label, gdouble value)
+{
+	if (!cra_metrics_enabled ())
+		return;
+	g_mutex_lock (&cra_metrics_mutex);
+	cra_metrics_get_value (metric, label)->value += value;
+	g_mutex_unlock (&cra_metrics_mutex);
+}
+
+/**
+ * cra_metrics_set:
+ */
+void
+cra_metrics_set (CraMetric metric, const gchar *label, gdouble value)
+{
+	if (!cra_metrics_enabled ())
+		return;
+	g_mutex_lock (&cra_metrics_mutex);
+	cra_metrics_get_value (metric, label)->value = value;
+	g_mutex_unlock (&cra_metrics_mutex);
+}
+
+/**
+ * cra_metrics_set_count:
+ *
+ * Sets a gauge that has no label without taking the lock, so that it can
+ * be called for every job.
+ */
+void
+cra_metrics_set_count (CraMetric metric, gint value)
+{
+	if (!cra_metrics_enabled ())
+		return;
+	g_atomic_int_set (&cra_metrics_counts[metric], value);
+	g_atomic_int_set (&cra_metrics_counts_set[metric], TRUE);
+}
+
+/**
+ * cra_metrics_observe:
+ *
+ * Adds @value to a histogram.
+ */
+void
+cra_metrics_observe (CraMetric metric, const gchar *label, gdouble value)
+{
+	CraMetricsValue *tmp;
+	guint i;
+
+	if (!cra_metrics_enabled ())
+		return;
+	g_mutex_lock (&cra_metrics_mutex);
+	tmp = cra_metrics_get_value (metric, label);
+	tmp->value += value;
+	tmp->count++;
+	for (i = 0; i < CRA_METRICS_BUCKETS; i++) {
+		if (value <= cra_metrics_buckets[i]) {
+			tmp->buckets[i]++;
+			break;
+		}
+	}
+	g_mutex_unlock (&cra_metrics_mutex);
+}
+
+/**
+ * cra_metrics_reset:
+ */
+void
+cra_metrics_reset (void)
+{
+	guint i;
+
+	g_mutex_lock (&cra_metrics_mutex);
+	for (i = 0; i < CRA_METRIC_LAST; i++) {
+		if (cra_metrics_values[i] != NULL)
+			g_hash_table_remove_all (cra_metrics_values[i]);
+		g_atomic_int_set (&cra_metrics_counts_set[i], FALSE);
+	}
+	g_mutex_unlock (&cra_metrics_mutex);
+}
+
+/**
+ * cra_metrics_to_string:
+ *
+ * Saves the counters and histograms so that a worker process can send them
+ * back to the coordinator, which adds them with
+ * cra_metrics_add_from_string(). Gauges are only set by the coordinator.
+ */
+GString *
+cra_metrics_to_string (void)
+{
+	CraMetricsValue *value;
+	GHashTableIter iter;
+	GString *str;
+	const gchar *label;
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+	guint i;
+	guint j;
+
+	str = g_string_new (NULL);
+	g_mutex_lock (&cra_metrics_mutex);
+	for (i = 0; i < CRA_METRIC_LAST; i++) {
+		if (cra_metrics_values[i] == NULL)
+			continue;
+		if (cra_metrics_info[i].kind == CRA_METRIC_KIND_GAUGE)
+			continue;
+		g_hash_table_iter_init (&iter, cra_metrics_values[i]);
+		while (g_hash_table_iter_next (&iter, (gpointer *) &label,
+					       (gpointer *) &value)) {
+			g_string_append_printf (str, "%u\t%s\t%s\t%" G_GUINT64_FORMAT,
+						i, label,
+						g_ascii_dtostr (buf, sizeof (buf),
+								value->value),
+						value->count);
+			for (j = 0; j < CRA_METRICS_BUCKETS; j++) {
+				g_string_append_printf (str, "\t%" G_GUINT64_FORMAT,
+							value->buckets[j]);
+			}
+			g_string_append_c (str, '\n');
+		}
+	}
+	g_mutex_unlock (&cra_metrics_mutex);
+	return str;
+}
+
+/**
+ * cra_metrics_add_from_string:
+ */
+void
+cra_metrics_add_from_string (const gchar *data, gsize len)
+{
+	CraMetricsValue *value;
+	guint i;
+	guint j;
+	guint metric;
+	_cleanup_free_ gchar *tmp = NULL;
+	_cleanup_strv_free_ gchar **lines = NULL;
+
+	tmp = g_strndup (data, len);
+	lines = g_strsplit (tmp, "\n", -1);
+	g_mutex_lock (&cra_metrics_mutex);
+	for (i = 0; lines[i] != NULL; i++) {
+		_cleanup_strv_free_ gchar **split = NULL;
+		split = g_strsplit (lines[i], "\t", -1);
+		if (g_strv_length (split) != 4 + CRA_METRICS_BUCKETS)
+			continue;
+		metric = g_ascii_strtoull (split[0], NULL, 10);
+		if (metric >= CRA_METRIC_LAST)
+			continue;
+		value = cra_metrics_get_value (metric, split[1]);
+		value->value += g_ascii_strtod (split[2], NULL);
+		value->count += g_ascii_strtoull (split[3], NULL, 10);
+		for (j = 0; j < CRA_METRICS_BUCKETS; j++)
+			value->buckets[j] += g_ascii_strtoull (split[4 + j], NULL, 10);
+	}
+	g_mutex_unlock (&cra_metrics_mutex);
+}
+
+/**
+ * cra_metrics_append_sample:
+ */
+static void
+cra_metrics_append_sample (GString *str,
+			   const CraMetricInfo *info,
+			   const gchar *suffix,
+			   const gchar *label,
+			   const gchar *le,
+			   gdouble value)
+{
+	const gchar *tmp;
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_string_append (str, info->name);
+	g_string_append (str, suffix);
+	if (info->label != NULL || le != NULL)
+		g_string_append_c (str, '{');
+	if (info->label != NULL) {
+		g_string_append_printf (str, "%s=\"", info->label);
+		for (tmp = label; *tmp != '\0'; tmp++) {
+			if (*tmp == '\n') {
+				g_string_append (str, "\\n");
+				continue;
+			}
+			if (*tmp == '"' || *tmp == '\\')
+				g_string_append_c (str, '\\');
+			g_string_append_c (str, *tmp);
+		}
+		g_string_append_c (str, '"');
+	}
+	if (le != NULL) {
+		if (info->label != NULL)
+			g_string_append_c (str, ',');
+		g_string_append_printf (str, "le=\"%s\"", le);
+	}
+	if (info->label != NULL || le != NULL)
+		g_string_append_c (str, '}');
+	g_string_append_printf (str, " %s\n",
+				g_ascii_dtostr (buf, sizeof (buf), value));
+}
+
+/**
+ * cra_metrics_write:
+ *
+ * Replaces the metrics file atomically, so that a scraper never sees it
+ * half written.
+ */
+gboolean
+cra_metrics_write (GError **error)
+{
+	const CraMetricInfo *info;
+	CraMetricsValue *value;
+	GList *l;
+	const gchar *types[] = { "counter", "gauge", "histogram" };
+	gboolean count_set;
+	gchar le[G_ASCII_DTOSTR_BUF_SIZE];
+	guint64 cumulative;
+	guint i;
+	guint j;
+	_cleanup_string_free_ GString *str = NULL;
+
+	if (!cra_metrics_enabled ())
+		return TRUE;
+
+	str = g_string_new (NULL);
+	g_mutex_lock (&cra_metrics_mutex);
+	for (i = 0; i < CRA_METRIC_LAST; i++) {
+		_cleanup_list_free_ GList *labels = NULL;
+		count_set = g_atomic_int_get (&cra_metrics_counts_set[i]);
+		if (cra_metrics_values[i] == NULL && !count_set)
+			continue;
+		info = &cra_metrics_info[i];
+		g_string_append_printf (str, "# HELP %s %s\n", info->name, info->help);
+		g_string_append_printf (str, "# TYPE %s %s\n", info->name, types[info->kind]);
+		if (count_set) {
+			cra_metrics_append_sample (str, info, "", "", NULL,
+						   g_atomic_int_get (&cra_metrics_counts[i]));
+			continue;
+		}
+
+		/* sorted so the file diffs nicely */
+		labels = g_hash_table_get_keys (cra_metrics_values[i]);
+		labels = g_list_sort (labels, (GCompareFunc) g_strcmp0);
+		for (l = labels; l != NULL; l = l->next) {
+			value = g_hash_table_lookup (cra_metrics_values[i], l->data);
+			if (info->kind != CRA_METRIC_KIND_HISTOGRAM) {
+				cra_metrics_append_sample (str, info, "", l->data,
+							   NULL, value->value);
+				continue;
+			}
+			cumulative = 0;
+			for (j = 0; j < CRA_METRICS_BUCKETS; j++) {
+				cumulative += value->buckets[j];
+				g_ascii_dtostr (le, sizeof (le), cra_metrics_buckets[j]);
+				cra_metrics_append_sample (str, info, "_bucket",
+							   l->data, le, cumulative);
+			}
+			cra_metrics_append_sample (str, info, "_bucket", l->data,
+						   "+Inf", value->count);
+			cra_metrics_append_sample (str, info, "_sum", l->data,
+						   NULL, value->value);
+			cra_metrics_append_sample (str, info, "_count", l->data,
+						   NULL, value->count);
+		}
+	}
+	g_mutex_unlock (&cra_metrics_mutex);
+	return g_file_set_contents (cra_metrics_filename, str->str, str->len, error);
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_METRICS_H
+#define __CRA_METRICS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+	CRA_METRIC_PACKAGES,
+	CRA_METRIC_APPS,
+	CRA_METRIC_VETOS,
+	CRA_METRIC_STAGE_SECONDS,
+	CRA_METRIC_SCREENSHOT_CACHE,
+	CRA_METRIC_EXTRACTED_BYTES,
+	CRA_METRIC_WRITTEN_BYTES,
+	CRA_METRIC_QUEUE_DEPTH,
+	CRA_METRIC_ELAPSED,
+	CRA_METRIC_LAST
+} CraMetric;
+
+void		 cra_metrics_set_filename		(const gchar	*filename);
+gboolean	 cra_metrics_enabled			(void);
+void		 cra_metrics_add			(CraMetric	 metric,
+							 const gchar	*label,
+							 gdouble	 value);
+void		 cra_metrics_set			(CraMetric	 metric,
+							 const gchar	*label,
+							 gdouble	 value);
+void		 cra_metrics_set_count			(CraMetric	 metric,
+							 gint		 value);
+void		 cra_metrics_observe			(CraMetric	 metric,
+							 const gchar	*label,
+							 gdouble	 value);
+void		 cra_metrics_reset			(void);
+GString		*cra_metrics_to_string			(void);
+void		 cra_metrics_add_from_string		(const gchar	*data,
+							 gsize		 len);
+gboolean	 cra_metrics_write			(GError		**error);
+
+G_END_DECLS
+
+#endif /* __CRA_METRICS_H */
@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <stdio.h>
+
 #include "cra-cleanup.h"
 #include "cra-package-deb.h"
 #include "cra-plugin.h"
@@ -111,6 +113,8 @@ cra_package_deb_ensure_filelists (CraPackage *pkg, GError **error)
 	const gchar *argv[4] = { "dpkg", "--contents", "fn", NULL };
 	const gchar *fn;
 	guint i;
+	guint64 size;
+	_cleanup_array_unref_ GArray *filesizes = NULL;
 	_cleanup_free_ gchar *output = NULL;
 	_cleanup_ptrarray_unref_ GPtrArray *files = NULL;
 	_cleanup_strv_free_ gchar **lines = NULL;
@@ -125,6 +129,7 @@ cra_package_deb_ensure_filelists (CraPackage *pkg, GError **error)
 
 	/* parse output */
 	files = g_ptr_array_new_with_free_func (g_free);
+	filesizes = g_array_new (FALSE, FALSE, sizeof (guint64));
 	lines = g_strsplit (output, "\n", -1);
 	for (i = 0; lines[i] != NULL; i++) {
 		fn = g_strrstr (lines[i], " ");
@@ -134,11 +139,17 @@ cra_package_deb_ensure_filelists (CraPackage *pkg, GError **error)
 		if (g_str_has_suffix (fn, "/"))
 			continue;
 		g_ptr_array_add (files, g_strdup (fn + 2));
+
+		/* this is "$MODE $OWNER $SIZE $DATE $TIME $FILENAME" */
+		if (sscanf (lines[i], "%*s %*s %" G_GUINT64_FORMAT, &size) != 1)
+			size = 0;
+		g_array_append_val (filesizes, size);
 	}
 
 	/* save */
 	g_ptr_array_add (files, NULL);
 	cra_package_set_filelist (pkg, (gchar **) files->pdata);
+	cra_package_set_filesizes (pkg, filesizes);
 	return TRUE;
 }
 
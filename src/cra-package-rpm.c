@@ -462,7 +462,9 @@ cra_package_rpm_ensure_filelists (CraPackage *pkg, GError **error)
 	gboolean ret = TRUE;
 	gint rc;
 	guint i;
-	rpmtd td[3] = { NULL, NULL, NULL };
+	guint64 size;
+	rpmtd td[4] = { NULL, NULL, NULL, NULL };
+	_cleanup_array_unref_ GArray *filesizes = NULL;
 	_cleanup_free_ const gchar **dirnames = NULL;
 	_cleanup_free_ gint32 *dirindex = NULL;
 	_cleanup_strv_free_ gchar **filelist = NULL;
@@ -501,8 +503,25 @@ cra_package_rpm_ensure_filelists (CraPackage *pkg, GError **error)
 		i++;
 	}
 	cra_package_set_filelist (pkg, filelist);
+
+	/* read out the file sizes, which are only used as a hint */
+	td[3] = rpmtdNew ();
+	rc = headerGet (priv->h, RPMTAG_LONGFILESIZES, td[3], HEADERGET_MINMEM);
+	if (!rc)
+		rc = headerGet (priv->h, RPMTAG_FILESIZES, td[3], HEADERGET_MINMEM);
+	if (rc) {
+		filesizes = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+					       rpmtdCount (td[3]));
+		while (rpmtdNext (td[3]) != -1) {
+			size = rpmtdGetNumber (td[3]);
+			g_array_append_val (filesizes, size);
+		}
+		cra_package_set_filesizes (pkg, filesizes);
+	}
 out:
-	for (i = 0; i < 3; i++) {
+	for (i = 0; i < 4; i++) {
+		if (td[i] == NULL)
+			continue;
 		rpmtdFreeData (td[i]);
 		rpmtdFree (td[i]);
 	}
@@ -22,16 +22,21 @@
 #include "config.h"
 
 #include <limits.h>
+#include <string.h>
 
 #include "cra-cleanup.h"
+#include "cra-memory.h"
 #include "cra-package.h"
 #include "cra-plugin.h"
+#include "cra-profile.h"
+#include "cra-utils.h"
 
 typedef struct _CraPackagePrivate	CraPackagePrivate;
 struct _CraPackagePrivate
 {
 	gboolean	 enabled;
 	gchar		**filelist;
+	GArray		*filesizes;		/* of guint64, or %NULL */
 	gchar		**deps;
 	gchar		*filename;
 	gchar		*basename;
@@ -45,14 +50,31 @@ struct _CraPackagePrivate
 	gchar		*evr;
 	gchar		*license;
 	gchar		*source;
-	GString		*log;
+	GArray		*log;			/* of CraPackageLogEntry */
+	GMutex		 log_mutex;		/* for ->log */
+	GCancellable	*cancellable;
+	GMutex		 stage_mutex;		/* for ->plugin, ->stage */
+	const gchar	*plugin;		/* not owned, or %NULL */
+	const gchar	*stage;			/* not owned, or %NULL */
+	gint64		 plugin_start;
 	GHashTable	*configs;
-	GTimer		*timer;
-	gdouble		 last_log;
+	gint64		 log_start;
 	GPtrArray	*releases;
 	GHashTable	*releases_hash;
 };
 
+typedef struct {
+	gint64			 time;		/* monotonic */
+	CraPackageLogLevel	 log_level;
+	const gchar		*plugin;	/* not owned, or %NULL */
+	const gchar		*stage;		/* not owned, or %NULL */
+	gchar			*text;
+} CraPackageLogEntry;
+
+/* resolved once, as looking at the environment takes a global lock */
+static gboolean cra_package_log_profile = FALSE;
+static gboolean cra_package_log_verbose = FALSE;
+
 G_DEFINE_TYPE_WITH_PRIVATE (CraPackage, cra_package, G_TYPE_OBJECT)
 
 #define GET_PRIVATE(o) (cra_package_get_instance_private (o))
@@ -67,6 +89,8 @@ cra_package_finalize (GObject *object)
 	CraPackagePrivate *priv = GET_PRIVATE (pkg);
 
 	g_strfreev (priv->filelist);
+	if (priv->filesizes != NULL)
+		g_array_unref (priv->filesizes);
 	g_strfreev (priv->deps);
 	g_free (priv->filename);
 	g_free (priv->basename);
@@ -79,8 +103,10 @@ cra_package_finalize (GObject *object)
 	g_free (priv->evr);
 	g_free (priv->license);
 	g_free (priv->source);
-	g_string_free (priv->log, TRUE);
-	g_timer_destroy (priv->timer);
+	g_array_unref (priv->log);
+	g_mutex_clear (&priv->log_mutex);
+	g_object_unref (priv->cancellable);
+	g_mutex_clear (&priv->stage_mutex);
 	g_hash_table_unref (priv->configs);
 	g_ptr_array_unref (priv->releases);
 	g_hash_table_unref (priv->releases_hash);
@@ -88,6 +114,16 @@ cra_package_finalize (GObject *object)
 	G_OBJECT_CLASS (cra_package_parent_class)->finalize (object);
 }
 
+/**
+ * cra_package_log_entry_clear:
+ **/
+static void
+cra_package_log_entry_clear (gpointer data)
+{
+	CraPackageLogEntry *entry = (CraPackageLogEntry *) data;
+	g_free (entry->text);
+}
+
 /**
  * cra_package_init:
  **/
@@ -96,8 +132,12 @@ cra_package_init (CraPackage *pkg)
 {
 	CraPackagePrivate *priv = GET_PRIVATE (pkg);
 	priv->enabled = TRUE;
-	priv->log = g_string_sized_new (1024);
-	priv->timer = g_timer_new ();
+	priv->log = g_array_new (FALSE, FALSE, sizeof (CraPackageLogEntry));
+	g_array_set_clear_func (priv->log, cra_package_log_entry_clear);
+	g_mutex_init (&priv->log_mutex);
+	priv->cancellable = g_cancellable_new ();
+	g_mutex_init (&priv->stage_mutex);
+	priv->log_start = g_get_monotonic_time ();
 	priv->configs = g_hash_table_new_full (g_str_hash, g_str_equal,
 					       g_free, g_free);
 	priv->releases = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
@@ -132,7 +172,44 @@ void
 cra_package_log_start (CraPackage *pkg)
 {
 	CraPackagePrivate *priv = GET_PRIVATE (pkg);
-	g_timer_reset (priv->timer);
+	priv->log_start = g_get_monotonic_time ();
+}
+
+/**
+ * cra_package_log_init:
+ *
+ * Works out what gets logged, the first time anything is logged.
+ **/
+static void
+cra_package_log_init (void)
+{
+	static gsize once = 0;
+	const gchar *domains;
+
+	if (!g_once_init_enter (&once))
+		return;
+	cra_package_log_profile = cra_profile_enabled ();
+	domains = g_getenv ("G_MESSAGES_DEBUG");
+	if (domains != NULL) {
+		cra_package_log_verbose = strstr (domains, "all") != NULL ||
+					  strstr (domains, G_LOG_DOMAIN) != NULL;
+	}
+	g_once_init_leave (&once, 1);
+}
+
+/**
+ * cra_package_log_level_to_string:
+ **/
+static const gchar *
+cra_package_log_level_to_string (CraPackageLogLevel log_level)
+{
+	if (log_level == CRA_PACKAGE_LOG_LEVEL_INFO)
+		return "INFO:    ";
+	if (log_level == CRA_PACKAGE_LOG_LEVEL_DEBUG)
+		return "DEBUG:   ";
+	if (log_level == CRA_PACKAGE_LOG_LEVEL_WARNING)
+		return "WARNING: ";
+	return "";
 }
 
 /**
@@ -144,55 +221,152 @@ cra_package_log (CraPackage *pkg,
 		 const gchar *fmt, ...)
 {
 	CraPackagePrivate *priv = GET_PRIVATE (pkg);
+	CraPackageLogEntry entry;
 	va_list args;
-	gdouble now;
-	_cleanup_free_ gchar *tmp;
+
+	/* debug messages are only kept when profiling */
+	cra_package_log_init ();
+	if (log_level == CRA_PACKAGE_LOG_LEVEL_DEBUG &&
+	    !cra_package_log_profile && !cra_package_log_verbose)
+		return;
 
 	va_start (args, fmt);
-	tmp = g_strdup_vprintf (fmt, args);
+	entry.text = g_strdup_vprintf (fmt, args);
 	va_end (args);
-	if (g_getenv ("CRA_PROFILE") != NULL) {
-		now = g_timer_elapsed (priv->timer, NULL) * 1000;
-		g_string_append_printf (priv->log,
-					"%05.0f\t+%05.0f\t",
-					now, now - priv->last_log);
-		priv->last_log = now;
+	if (cra_package_log_verbose) {
+		g_debug ("%s%s",
+			 cra_package_log_level_to_string (log_level),
+			 entry.text);
 	}
-	switch (log_level) {
-	case CRA_PACKAGE_LOG_LEVEL_INFO:
-		g_debug ("INFO:    %s", tmp);
-		g_string_append_printf (priv->log, "INFO:    %s\n", tmp);
-		break;
-	case CRA_PACKAGE_LOG_LEVEL_DEBUG:
-		g_debug ("DEBUG:   %s", tmp);
-		if (g_getenv ("CRA_PROFILE") != NULL)
-			g_string_append_printf (priv->log, "DEBUG:   %s\n", tmp);
-		break;
-	case CRA_PACKAGE_LOG_LEVEL_WARNING:
-		g_debug ("WARNING: %s", tmp);
-		g_string_append_printf (priv->log, "WARNING: %s\n", tmp);
-		break;
-	default:
-		g_debug ("%s", tmp);
-		g_string_append_printf (priv->log, "%s\n", tmp);
-		break;
+	if (log_level == CRA_PACKAGE_LOG_LEVEL_DEBUG && !cra_package_log_profile) {
+		g_free (entry.text);
+		return;
 	}
+
+	/* the timestamps are only formatted when the log is written */
+	entry.log_level = log_level;
+	entry.time = 0;
+	entry.plugin = NULL;
+	entry.stage = NULL;
+	if (cra_package_log_profile) {
+		entry.time = g_get_monotonic_time ();
+		g_mutex_lock (&priv->stage_mutex);
+		entry.plugin = priv->plugin;
+		entry.stage = priv->stage;
+		g_mutex_unlock (&priv->stage_mutex);
+	}
+
+	/* subtasks may be logging for the same package at the same time */
+	g_mutex_lock (&priv->log_mutex);
+	g_array_append_val (priv->log, entry);
+	g_mutex_unlock (&priv->log_mutex);
 }
 
 /**
- * cra_package_log_flush:
+ * cra_package_log_to_string:
  **/
-gboolean
-cra_package_log_flush (CraPackage *pkg, GError **error)
+static GString *
+cra_package_log_to_string (CraPackage *pkg)
 {
 	CraPackagePrivate *priv = GET_PRIVATE (pkg);
-	_cleanup_free_ gchar *logfile;
+	CraPackageLogEntry *entry;
+	GString *str;
+	const gchar *tmp;
+	gdouble last = 0.f;
+	gdouble now;
+	guint i;
+
+	str = g_string_sized_new (1024);
+	for (i = 0; i < priv->log->len; i++) {
+		entry = &g_array_index (priv->log, CraPackageLogEntry, i);
+		if (cra_package_log_profile) {
+			now = (entry->time - priv->log_start) / 1000.f;
+			g_string_append_printf (str, "%05.0f\t+%05.0f\t%s\t%s\t",
+						now, now - last,
+						entry->plugin ? entry->plugin : "-",
+						entry->stage ? entry->stage : "-");
+			last = now;
+		}
+		tmp = cra_package_log_level_to_string (entry->log_level);
+		g_string_append (str, tmp);
+		g_string_append (str, entry->text);
+		g_string_append_c (str, '\n');
+	}
+	return str;
+}
 
-	/* overwrite old log */
-	logfile = g_strdup_printf ("%s/%s.log",
-				   cra_package_get_config (pkg, "LogDir"),
-				   cra_package_get_name (pkg));
-	return g_file_set_contents (logfile, priv->log->str, -1, error);
+/**
+ * cra_package_get_log:
+ *
+ * Returns the formatted log, for the caller to write somewhere.
+ **/
+GString *
+cra_package_get_log (CraPackage *pkg)
+{
+	CraPackagePrivate *priv = GET_PRIVATE (pkg);
+	GString *str;
+
+	g_mutex_lock (&priv->log_mutex);
+	str = cra_package_log_to_string (pkg);
+	g_mutex_unlock (&priv->log_mutex);
+	return str;
+}
+
+/**
+ * cra_package_set_stage:
+ *
+ * Records what the package is being processed by, so that a package that
+ * takes too long can say where it was stuck. @plugin and @stage have to be
+ * static strings or outlive the package.
+ **/
+void
+cra_package_set_stage (CraPackage *pkg, const gchar *plugin, const gchar *stage)
+{
+	CraPackagePrivate *priv = GET_PRIVATE (pkg);
+	g_mutex_lock (&priv->stage_mutex);
+	if (priv->plugin_start == 0 || g_strcmp0 (priv->plugin, plugin) != 0)
+		priv->plugin_start = g_get_monotonic_time ();
+	priv->plugin = plugin;
+	priv->stage = stage;
+	g_mutex_unlock (&priv->stage_mutex);
+	cra_memory_sample (priv->name, stage);
+}
+
+/**
+ * cra_package_get_stage:
+ *
+ * Returns the number of seconds spent in the current plugin.
+ **/
+gdouble
+cra_package_get_stage (CraPackage *pkg, const gchar **plugin, const gchar **stage)
+{
+	CraPackagePrivate *priv = GET_PRIVATE (pkg);
+	gdouble elapsed = 0.f;
+
+	g_mutex_lock (&priv->stage_mutex);
+	if (plugin != NULL)
+		*plugin = priv->plugin;
+	if (stage != NULL)
+		*stage = priv->stage;
+	if (priv->plugin_start > 0) {
+		elapsed = g_get_monotonic_time () - priv->plugin_start;
+		elapsed /= G_USEC_PER_SEC;
+	}
+	g_mutex_unlock (&priv->stage_mutex);
+	return elapsed;
+}
+
+/**
+ * cra_package_get_cancellable:
+ *
+ * Gets the cancellable that is triggered when the package has run out of
+ * time. Plugins should check this in anything that might loop for a while.
+ **/
+GCancellable *
+cra_package_get_cancellable (CraPackage *pkg)
+{
+	CraPackagePrivate *priv = GET_PRIVATE (pkg);
+	return priv->cancellable;
 }
 
 /**
@@ -384,6 +558,46 @@ cra_package_set_filelist (CraPackage *pkg, gchar **filelist)
 	priv->filelist = g_strdupv (filelist);
 }
 
+/**
+ * cra_package_set_filesizes:
+ *
+ * Sets the uncompressed size of each file, in the same order as the filelist.
+ **/
+void
+cra_package_set_filesizes (CraPackage *pkg, GArray *filesizes)
+{
+	CraPackagePrivate *priv = GET_PRIVATE (pkg);
+	if (priv->filesizes != NULL)
+		g_array_unref (priv->filesizes);
+	priv->filesizes = g_array_ref (filesizes);
+}
+
+/**
+ * cra_package_get_explode_size:
+ *
+ * Returns the number of bytes cra_package_explode() would write for @glob,
+ * or 0 if the file sizes are not known.
+ **/
+guint64
+cra_package_get_explode_size (CraPackage *pkg, GPtrArray *glob)
+{
+	CraPackagePrivate *priv = GET_PRIVATE (pkg);
+	guint64 size = 0;
+	guint i;
+
+	if (priv->filelist == NULL || priv->filesizes == NULL)
+		return 0;
+	for (i = 0; priv->filelist[i] != NULL; i++) {
+		if (i >= priv->filesizes->len)
+			break;
+		if (glob != NULL &&
+		    cra_glob_value_search (glob, priv->filelist[i]) == NULL)
+			continue;
+		size += g_array_index (priv->filesizes, guint64, i);
+	}
+	return size;
+}
+
 /**
  * cra_package_get_nevr:
  **/
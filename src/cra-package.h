@@ -23,6 +23,7 @@
 #define CRA_PACKAGE_H
 
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include <stdarg.h>
 #include <appstream-glib.h>
@@ -74,8 +75,14 @@ void		 cra_package_log		(CraPackage	*pkg,
 						 const gchar	*fmt,
 						 ...)
 						 G_GNUC_PRINTF (3, 4);
-gboolean	 cra_package_log_flush		(CraPackage	*pkg,
-						 GError		**error);
+GString		*cra_package_get_log		(CraPackage	*pkg);
+void		 cra_package_set_stage		(CraPackage	*pkg,
+						 const gchar	*plugin,
+						 const gchar	*stage);
+gdouble		 cra_package_get_stage		(CraPackage	*pkg,
+						 const gchar	**plugin,
+						 const gchar	**stage);
+GCancellable	*cra_package_get_cancellable	(CraPackage	*pkg);
 gboolean	 cra_package_open		(CraPackage	*pkg,
 						 const gchar	*filename,
 						 GError		**error);
@@ -112,6 +119,10 @@ void		 cra_package_set_deps		(CraPackage	*pkg,
 void		 cra_package_set_filelist	(CraPackage	*pkg,
 						 gchar		**filelist);
 gchar		**cra_package_get_filelist	(CraPackage	*pkg);
+void		 cra_package_set_filesizes	(CraPackage	*pkg,
+						 GArray		*filesizes);
+guint64		 cra_package_get_explode_size	(CraPackage	*pkg,
+						 GPtrArray	*glob);
 gchar		**cra_package_get_deps		(CraPackage	*pkg);
 GPtrArray	*cra_package_get_releases	(CraPackage	*pkg);
 void		 cra_package_set_config		(CraPackage	*pkg,
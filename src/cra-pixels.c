@@ -0,0 +1,468 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Whole-image checks on 8-bit RGBA pixbufs. Each kernel works on one row at
+ * a time, using AVX2 or SSE2 where the CPU has it and plain C otherwise. The
+ * alpha byte is the last of each pixel, so a byte mask of 0x8888 picks out
+ * the alpha of four pixels from a 16 byte load.
+ */
+
+#include "config.h"
+
+#include "cra-pixels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRA_PIXELS_X86
+#include <immintrin.h>
+#endif
+
+typedef struct {
+	const gchar	*name;
+	guint		 (*count_alpha)		(const guint8 *row, guint width);
+	gboolean	 (*has_translucent)	(const guint8 *row, guint width);
+	gint		 (*find_first)		(const guint8 *row, guint width);
+	gint		 (*find_last)		(const guint8 *row, guint width);
+} CraPixelsKernels;
+
+/**
+ * cra_pixels_count_alpha_scalar:
+ */
+static guint
+cra_pixels_count_alpha_scalar (const guint8 *row, guint width)
+{
+	guint cnt = 0;
+	guint i;
+
+	for (i = 0; i < width; i++) {
+		if (row[i * 4 + 3] > 0)
+			cnt++;
+	}
+	return cnt;
+}
+
+/**
+ * cra_pixels_has_translucent_scalar:
+ */
+static gboolean
+cra_pixels_has_translucent_scalar (const guint8 *row, guint width)
+{
+	guint i;
+
+	for (i = 0; i < width; i++) {
+		if (row[i * 4 + 3] != 0xff)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * cra_pixels_find_first_scalar:
+ */
+static gint
+cra_pixels_find_first_scalar (const guint8 *row, guint width)
+{
+	guint i;
+
+	for (i = 0; i < width; i++) {
+		if (row[i * 4 + 3] > 0)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * cra_pixels_find_last_scalar:
+ */
+static gint
+cra_pixels_find_last_scalar (const guint8 *row, guint width)
+{
+	guint i;
+
+	for (i = width; i > 0; i--) {
+		if (row[(i - 1) * 4 + 3] > 0)
+			return i - 1;
+	}
+	return -1;
+}
+
+static const CraPixelsKernels cra_pixels_kernels_scalar = {
+	"scalar",
+	cra_pixels_count_alpha_scalar,
+	cra_pixels_has_translucent_scalar,
+	cra_pixels_find_first_scalar,
+	cra_pixels_find_last_scalar };
+
+#ifdef CRA_PIXELS_X86
+
+/**
+ * cra_pixels_alpha_mask_sse2:
+ *
+ * Returns the movemask bits of the four alpha bytes that equal @value.
+ */
+__attribute__ ((target ("sse2")))
+static inline guint
+cra_pixels_alpha_mask_sse2 (const guint8 *data, __m128i value)
+{
+	__m128i tmp = _mm_loadu_si128 ((const __m128i *) data);
+	return _mm_movemask_epi8 (_mm_cmpeq_epi8 (tmp, value)) & 0x8888;
+}
+
+/**
+ * cra_pixels_count_alpha_sse2:
+ */
+__attribute__ ((target ("sse2")))
+static guint
+cra_pixels_count_alpha_sse2 (const guint8 *row, guint width)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	guint cnt = 0;
+	guint i;
+
+	for (i = 0; i + 4 <= width; i += 4)
+		cnt += 4 - __builtin_popcount (cra_pixels_alpha_mask_sse2 (row + i * 4, zero));
+	return cnt + cra_pixels_count_alpha_scalar (row + i * 4, width - i);
+}
+
+/**
+ * cra_pixels_has_translucent_sse2:
+ */
+__attribute__ ((target ("sse2")))
+static gboolean
+cra_pixels_has_translucent_sse2 (const guint8 *row, guint width)
+{
+	const __m128i opaque = _mm_set1_epi8 ((gchar) 0xff);
+	guint i;
+
+	for (i = 0; i + 4 <= width; i += 4) {
+		if (cra_pixels_alpha_mask_sse2 (row + i * 4, opaque) != 0x8888)
+			return TRUE;
+	}
+	return cra_pixels_has_translucent_scalar (row + i * 4, width - i);
+}
+
+/**
+ * cra_pixels_find_first_sse2:
+ */
+__attribute__ ((target ("sse2")))
+static gint
+cra_pixels_find_first_sse2 (const guint8 *row, guint width)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	guint i;
+	guint mask;
+	gint tmp;
+
+	for (i = 0; i + 4 <= width; i += 4) {
+		mask = cra_pixels_alpha_mask_sse2 (row + i * 4, zero) ^ 0x8888;
+		if (mask != 0)
+			return i + __builtin_ctz (mask) / 4;
+	}
+	tmp = cra_pixels_find_first_scalar (row + i * 4, width - i);
+	return tmp < 0 ? -1 : (gint) i + tmp;
+}
+
+/**
+ * cra_pixels_find_last_sse2:
+ */
+__attribute__ ((target ("sse2")))
+static gint
+cra_pixels_find_last_sse2 (const guint8 *row, guint width)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	guint i = width - width % 4;
+	guint mask;
+	gint tmp;
+
+	tmp = cra_pixels_find_last_scalar (row + i * 4, width - i);
+	if (tmp >= 0)
+		return i + tmp;
+	for (; i > 0; i -= 4) {
+		mask = cra_pixels_alpha_mask_sse2 (row + (i - 4) * 4, zero) ^ 0x8888;
+		if (mask != 0)
+			return i - 4 + (31 - __builtin_clz (mask)) / 4;
+	}
+	return -1;
+}
+
+static const CraPixelsKernels cra_pixels_kernels_sse2 = {
+	"sse2",
+	cra_pixels_count_alpha_sse2,
+	cra_pixels_has_translucent_sse2,
+	cra_pixels_find_first_sse2,
+	cra_pixels_find_last_sse2 };
+
+/**
+ * cra_pixels_alpha_mask_avx2:
+ *
+ * Returns the movemask bits of the eight alpha bytes that equal @value.
+ */
+__attribute__ ((target ("avx2")))
+static inline guint32
+cra_pixels_alpha_mask_avx2 (const guint8 *data, __m256i value)
+{
+	__m256i tmp = _mm256_loadu_si256 ((const __m256i *) data);
+	return (guint32) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (tmp, value)) & 0x88888888;
+}
+
+/**
+ * cra_pixels_count_alpha_avx2:
+ */
+__attribute__ ((target ("avx2")))
+static guint
+cra_pixels_count_alpha_avx2 (const guint8 *row, guint width)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	guint cnt = 0;
+	guint i;
+
+	for (i = 0; i + 8 <= width; i += 8)
+		cnt += 8 - __builtin_popcount (cra_pixels_alpha_mask_avx2 (row + i * 4, zero));
+	return cnt + cra_pixels_count_alpha_scalar (row + i * 4, width - i);
+}
+
+/**
+ * cra_pixels_has_translucent_avx2:
+ */
+__attribute__ ((target ("avx2")))
+static gboolean
+cra_pixels_has_translucent_avx2 (const guint8 *row, guint width)
+{
+	const __m256i opaque = _mm256_set1_epi8 ((gchar) 0xff);
+	guint i;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		if (cra_pixels_alpha_mask_avx2 (row + i * 4, opaque) != 0x88888888)
+			return TRUE;
+	}
+	return cra_pixels_has_translucent_scalar (row + i * 4, width - i);
+}
+
+/**
+ * cra_pixels_find_first_avx2:
+ */
+__attribute__ ((target ("avx2")))
+static gint
+cra_pixels_find_first_avx2 (const guint8 *row, guint width)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	guint32 mask;
+	guint i;
+	gint tmp;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		mask = cra_pixels_alpha_mask_avx2 (row + i * 4, zero) ^ 0x88888888;
+		if (mask != 0)
+			return i + __builtin_ctz (mask) / 4;
+	}
+	tmp = cra_pixels_find_first_scalar (row + i * 4, width - i);
+	return tmp < 0 ? -1 : (gint) i + tmp;
+}
+
+/**
+ * cra_pixels_find_last_avx2:
+ */
+__attribute__ ((target ("avx2")))
+static gint
+cra_pixels_find_last_avx2 (const guint8 *row, guint width)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	guint32 mask;
+	guint i = width - width % 8;
+	gint tmp;
+
+	tmp = cra_pixels_find_last_scalar (row + i * 4, width - i);
+	if (tmp >= 0)
+		return i + tmp;
+	for (; i > 0; i -= 8) {
+		mask = cra_pixels_alpha_mask_avx2 (row + (i - 8) * 4, zero) ^ 0x88888888;
+		if (mask != 0)
+			return i - 8 + (31 - __builtin_clz (mask)) / 4;
+	}
+	return -1;
+}
+
+static const CraPixelsKernels cra_pixels_kernels_avx2 = {
+	"avx2",
+	cra_pixels_count_alpha_avx2,
+	cra_pixels_has_translucent_avx2,
+	cra_pixels_find_first_avx2,
+	cra_pixels_find_last_avx2 };
+
+#endif /* CRA_PIXELS_X86 */
+
+/**
+ * cra_pixels_get_kernels:
+ *
+ * Returns the fastest kernels the CPU supports, which is only worked out
+ * once.
+ */
+static const CraPixelsKernels *
+cra_pixels_get_kernels (void)
+{
+	static gsize kernels = 0;
+	const CraPixelsKernels *tmp = &cra_pixels_kernels_scalar;
+
+	if (g_once_init_enter (&kernels)) {
+#ifdef CRA_PIXELS_X86
+		__builtin_cpu_init ();
+		if (__builtin_cpu_supports ("avx2"))
+			tmp = &cra_pixels_kernels_avx2;
+		else if (__builtin_cpu_supports ("sse2"))
+			tmp = &cra_pixels_kernels_sse2;
+#endif
+		g_debug ("using %s pixel kernels", tmp->name);
+		g_once_init_leave (&kernels, (gsize) tmp);
+	}
+	return (const CraPixelsKernels *) kernels;
+}
+
+/**
+ * cra_pixels_is_rgba:
+ */
+static gboolean
+cra_pixels_is_rgba (const GdkPixbuf *pixbuf)
+{
+	return gdk_pixbuf_get_has_alpha (pixbuf) &&
+	       gdk_pixbuf_get_n_channels (pixbuf) == 4 &&
+	       gdk_pixbuf_get_bits_per_sample (pixbuf) == 8;
+}
+
+/**
+ * cra_pixels_count_alpha:
+ *
+ * Returns the number of pixels that are not fully transparent, stopping
+ * once there are more than @limit. Pixbufs without alpha count as opaque.
+ */
+guint
+cra_pixels_count_alpha (const GdkPixbuf *pixbuf, guint limit)
+{
+	const CraPixelsKernels *k;
+	const guint8 *pixels;
+	guint cnt = 0;
+	guint height;
+	guint j;
+	guint rowstride;
+	guint width;
+
+	width = gdk_pixbuf_get_width (pixbuf);
+	height = gdk_pixbuf_get_height (pixbuf);
+	if (!cra_pixels_is_rgba (pixbuf))
+		return width * height;
+
+	k = cra_pixels_get_kernels ();
+	pixels = gdk_pixbuf_get_pixels (pixbuf);
+	rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+	for (j = 0; j < height && cnt <= limit; j++)
+		cnt += k->count_alpha (pixels + (gsize) j * rowstride, width);
+	return cnt;
+}
+
+/**
+ * cra_pixels_has_translucent:
+ *
+ * Returns %TRUE if any pixel is not fully opaque.
+ */
+gboolean
+cra_pixels_has_translucent (const GdkPixbuf *pixbuf)
+{
+	const CraPixelsKernels *k;
+	const guint8 *pixels;
+	guint height;
+	guint j;
+	guint rowstride;
+	guint width;
+
+	if (!cra_pixels_is_rgba (pixbuf))
+		return FALSE;
+
+	k = cra_pixels_get_kernels ();
+	pixels = gdk_pixbuf_get_pixels (pixbuf);
+	width = gdk_pixbuf_get_width (pixbuf);
+	height = gdk_pixbuf_get_height (pixbuf);
+	rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+	for (j = 0; j < height; j++) {
+		if (k->has_translucent (pixels + (gsize) j * rowstride, width))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * cra_pixels_get_bounds:
+ *
+ * Finds the smallest rectangle holding every pixel that is not fully
+ * transparent, returning %FALSE if there are none.
+ */
+gboolean
+cra_pixels_get_bounds (const GdkPixbuf *pixbuf,
+		       guint *x,
+		       guint *y,
+		       guint *width,
+		       guint *height)
+{
+	const CraPixelsKernels *k;
+	const guint8 *pixels;
+	const guint8 *row;
+	gint first;
+	gint last;
+	gint left = G_MAXINT;
+	gint right = -1;
+	gint top = -1;
+	gint bottom = -1;
+	guint j;
+	guint rowstride;
+	guint pixbuf_height;
+	guint pixbuf_width;
+
+	pixbuf_width = gdk_pixbuf_get_width (pixbuf);
+	pixbuf_height = gdk_pixbuf_get_height (pixbuf);
+	if (!cra_pixels_is_rgba (pixbuf)) {
+		*x = 0;
+		*y = 0;
+		*width = pixbuf_width;
+		*height = pixbuf_height;
+		return pixbuf_width > 0 && pixbuf_height > 0;
+	}
+
+	k = cra_pixels_get_kernels ();
+	pixels = gdk_pixbuf_get_pixels (pixbuf);
+	rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+	for (j = 0; j < pixbuf_height; j++) {
+		row = pixels + (gsize) j * rowstride;
+		first = k->find_first (row, pixbuf_width);
+		if (first < 0)
+			continue;
+		last = k->find_last (row, pixbuf_width);
+		if (top < 0)
+			top = j;
+		bottom = j;
+		left = MIN (left, first);
+		right = MAX (right, last);
+	}
+	if (top < 0)
+		return FALSE;
+	*x = left;
+	*y = top;
+	*width = right - left + 1;
+	*height = bottom - top + 1;
+	return TRUE;
+}
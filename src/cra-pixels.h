@@ -0,0 +1,41 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_PIXELS_H
+#define __CRA_PIXELS_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+guint		 cra_pixels_count_alpha			(const GdkPixbuf *pixbuf,
+							 guint		 limit);
+gboolean	 cra_pixels_has_translucent		(const GdkPixbuf *pixbuf);
+gboolean	 cra_pixels_get_bounds			(const GdkPixbuf *pixbuf,
+							 guint		*x,
+							 guint		*y,
+							 guint		*width,
+							 guint		*height);
+
+G_END_DECLS
+
+#endif /* __CRA_PIXELS_H */
@@ -26,6 +26,8 @@
 #include "cra-cleanup.h"
 #include "cra-plugin.h"
 #include "cra-plugin-loader.h"
+#include "cra-probes.h"
+#include "cra-profile.h"
 
 /**
  * cra_plugin_loader_plugin_free:
@@ -77,6 +79,7 @@ cra_plugin_loader_process_app (GPtrArray *plugins,
 	gboolean ret;
 	CraPluginProcessAppFunc plugin_func = NULL;
 	CraPlugin *plugin;
+	gint64 profile;
 	guint i;
 
 	/* run each plugin */
@@ -87,11 +90,24 @@ cra_plugin_loader_process_app (GPtrArray *plugins,
 				       (gpointer *) &plugin_func);
 		if (!ret)
 			continue;
+		if (g_cancellable_set_error_if_cancelled (cra_package_get_cancellable (pkg),
+							  error))
+			return FALSE;
+		cra_package_set_stage (pkg, plugin->name, "process-app");
 		cra_package_log (pkg,
 				 CRA_PACKAGE_LOG_LEVEL_DEBUG,
 				 "Running cra_plugin_process_app() from %s",
 				 plugin->name);
-		if (!plugin_func (plugin, pkg, app, tmpdir, error))
+		CRA_PROBE3 (plugin__entry,
+			    plugin->name, "process-app",
+			    cra_package_get_name (pkg));
+		profile = cra_profile_start ();
+		ret = plugin_func (plugin, pkg, app, tmpdir, error);
+		cra_profile_stop (profile, pkg, "process-app", plugin->name);
+		CRA_PROBE4 (plugin__exit,
+			    plugin->name, "process-app",
+			    cra_package_get_name (pkg), ret);
+		if (!ret)
 			return FALSE;
 	}
 	return TRUE;
@@ -150,18 +166,21 @@ cra_plugin_loader_get_globs (GPtrArray *plugins)
  * cra_plugin_loader_merge:
  */
 void
-cra_plugin_loader_merge (GPtrArray *plugins, GList **apps)
+cra_plugin_loader_merge (GPtrArray *plugins, CraStore *store)
 {
-	const gchar *key;
-	const gchar *tmp;
-	CraApp *app;
+	AsApp *app;
 	CraApp *found;
+	CraPackage *pkg;
 	CraPluginMergeFunc plugin_func = NULL;
 	CraPlugin *plugin;
+	GHashTableIter iter;
+	GPtrArray *apps;
 	gboolean ret;
-	GList *l;
+	gpointer key;
+	gpointer value;
 	guint i;
-	_cleanup_hashtable_unref_ GHashTable *hash;
+	guint j;
+	const gchar *tmp;
 
 	/* run each plugin */
 	for (i = 0; i < plugins->len; i++) {
@@ -171,43 +190,55 @@ cra_plugin_loader_merge (GPtrArray *plugins, GList **apps)
 				       (gpointer *) &plugin_func);
 		if (!ret)
 			continue;
-		plugin_func (plugin, apps);
+		plugin_func (plugin, store);
 	}
 
 	/* FIXME: move to font plugin */
-	for (l = *apps; l != NULL; l = l->next) {
-		if (!CRA_IS_APP (l->data))
-			continue;
-		app = CRA_APP (l->data);
-		as_app_remove_metadata (AS_APP (app), "FontFamily");
-		as_app_remove_metadata (AS_APP (app), "FontFullName");
-		as_app_remove_metadata (AS_APP (app), "FontIconText");
-		as_app_remove_metadata (AS_APP (app), "FontParent");
-		as_app_remove_metadata (AS_APP (app), "FontSampleText");
-		as_app_remove_metadata (AS_APP (app), "FontSubFamily");
-		as_app_remove_metadata (AS_APP (app), "FontClassifier");
+	apps = cra_store_get_apps (store);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+		as_app_remove_metadata (app, "FontFamily");
+		as_app_remove_metadata (app, "FontFullName");
+		as_app_remove_metadata (app, "FontIconText");
+		as_app_remove_metadata (app, "FontParent");
+		as_app_remove_metadata (app, "FontSampleText");
+		as_app_remove_metadata (app, "FontSubFamily");
+		as_app_remove_metadata (app, "FontClassifier");
 	}
 
-	/* deduplicate */
-	hash = g_hash_table_new (g_str_hash, g_str_equal);
-	for (l = *apps; l != NULL; l = l->next) {
-		if (!CRA_IS_APP (l->data))
-			continue;
-		app = CRA_APP (l->data);
-		key = as_app_get_id_full (AS_APP (app));
-		found = g_hash_table_lookup (hash, key);
-		if (found == NULL) {
-			g_hash_table_insert (hash,
-					     (gpointer) key,
-					     (gpointer) app);
+	/* deduplicate, only looking at the IDs used more than once */
+	g_hash_table_iter_init (&iter, cra_store_get_id_index (store));
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		apps = value;
+		if (apps->len < 2)
 			continue;
+		found = NULL;
+		for (j = 0; j < apps->len; j++) {
+			app = g_ptr_array_index (apps, j);
+			if (!CRA_IS_APP (app))
+				continue;
+			if (found == NULL) {
+				found = CRA_APP (app);
+				continue;
+			}
+			tmp = cra_app_get_package_nevr (found);
+			cra_app_add_veto (CRA_APP (app), "duplicate",
+					  "duplicate of %s", tmp);
+			pkg = cra_app_get_package (CRA_APP (app));
+			if (pkg == NULL)
+				continue;
+			cra_package_log (pkg,
+					 CRA_PACKAGE_LOG_LEVEL_WARNING,
+					 "duplicate %s not included as added from %s",
+					 (const gchar *) key, tmp);
 		}
-		tmp = cra_package_get_nevr (cra_app_get_package (found));
-		cra_app_add_veto (app, "duplicate of %s", tmp);
-		cra_package_log (cra_app_get_package (app),
-				 CRA_PACKAGE_LOG_LEVEL_WARNING,
-				 "duplicate %s not included as added from %s",
-				 key, tmp);
+	}
+
+	/* only needed to merge the output of shards */
+	apps = cra_store_get_apps (store);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+		as_app_remove_metadata (app, "X-CreaterepoAsPackage");
 	}
 }
 
@@ -65,6 +65,73 @@ cra_plugin_process (CraPlugin *plugin,
 	return plugin_func (plugin, pkg, tmpdir, error);
 }
 
+/**
+ * cra_plugin_process_file:
+ */
+gboolean
+cra_plugin_process_file (CraPlugin *plugin,
+			 CraPackage *pkg,
+			 const gchar *filename,
+			 GList **apps,
+			 const gchar *tmpdir,
+			 GError **error)
+{
+	CraPluginProcessFileFunc plugin_func = NULL;
+	gboolean ret;
+
+	/* run the plugin on just one file */
+	cra_package_log (pkg,
+			 CRA_PACKAGE_LOG_LEVEL_DEBUG,
+			 "Running cra_plugin_process_file() on %s from %s",
+			 filename, plugin->name);
+	ret = g_module_symbol (plugin->module,
+			       "cra_plugin_process_file",
+			       (gpointer *) &plugin_func);
+	if (!ret) {
+		g_set_error_literal (error,
+				     CRA_PLUGIN_ERROR,
+				     CRA_PLUGIN_ERROR_NOT_SUPPORTED,
+				     "no cra_plugin_process_file");
+		return FALSE;
+	}
+	return plugin_func (plugin, pkg, filename, apps, tmpdir, error);
+}
+
+/**
+ * cra_plugin_get_process_files:
+ *
+ * Returns the files in @pkg that the plugin can process one at a time, or
+ * %NULL if the plugin has to process the whole package at once.
+ */
+GPtrArray *
+cra_plugin_get_process_files (CraPlugin *plugin, CraPackage *pkg)
+{
+	CraPluginCheckFilenameFunc plugin_func = NULL;
+	GPtrArray *files;
+	gchar **filelist;
+	gpointer dummy = NULL;
+	guint i;
+
+	/* plugin does not support per-file processing */
+	if (!g_module_symbol (plugin->module,
+			      "cra_plugin_process_file",
+			      &dummy))
+		return NULL;
+	if (!g_module_symbol (plugin->module,
+			      "cra_plugin_check_filename",
+			      (gpointer *) &plugin_func))
+		return NULL;
+
+	/* find all the files the plugin wants */
+	files = g_ptr_array_new_with_free_func (g_free);
+	filelist = cra_package_get_filelist (pkg);
+	for (i = 0; filelist != NULL && filelist[i] != NULL; i++) {
+		if (plugin_func (plugin, filelist[i]))
+			g_ptr_array_add (files, g_strdup (filelist[i]));
+	}
+	return files;
+}
+
 /**
  * cra_plugin_add_app:
  */
@@ -29,6 +29,7 @@
 #include "cra-app.h"
 #include "cra-cleanup.h"
 #include "cra-package.h"
+#include "cra-store.h"
 #include "cra-utils.h"
 
 G_BEGIN_DECLS
@@ -60,13 +61,19 @@ typedef void		 (*CraPluginFunc)		(CraPlugin	*plugin);
 typedef void		 (*CraPluginGetGlobsFunc)	(CraPlugin	*plugin,
 							 GPtrArray	*globs);
 typedef void		 (*CraPluginMergeFunc)		(CraPlugin	*plugin,
-							 GList		**apps);
+							 CraStore	*store);
 typedef gboolean	 (*CraPluginCheckFilenameFunc)	(CraPlugin	*plugin,
 							 const gchar	*filename);
 typedef GList		*(*CraPluginProcessFunc)	(CraPlugin	*plugin,
 							 CraPackage 	*pkg,
 							 const gchar	*tmp_dir,
 							 GError		**error);
+typedef gboolean	 (*CraPluginProcessFileFunc)	(CraPlugin	*plugin,
+							 CraPackage 	*pkg,
+							 const gchar	*filename,
+							 GList		**apps,
+							 const gchar	*tmpdir,
+							 GError		**error);
 typedef gboolean	 (*CraPluginProcessAppFunc)	(CraPlugin	*plugin,
 							 CraPackage 	*pkg,
 							 CraApp 	*app,
@@ -82,10 +89,18 @@ GList		*cra_plugin_process			(CraPlugin	*plugin,
 							 CraPackage	*pkg,
 							 const gchar	*tmp_dir,
 							 GError		**error);
+gboolean	 cra_plugin_process_file		(CraPlugin	*plugin,
+							 CraPackage	*pkg,
+							 const gchar	*filename,
+							 GList		**apps,
+							 const gchar	*tmp_dir,
+							 GError		**error);
+GPtrArray	*cra_plugin_get_process_files		(CraPlugin	*plugin,
+							 CraPackage	*pkg);
 void		 cra_plugin_add_globs			(CraPlugin	*plugin,
 							 GPtrArray	*globs);
 void		 cra_plugin_merge			(CraPlugin	*plugin,
-							 GList		**list);
+							 CraStore	*store);
 gboolean	 cra_plugin_process_app			(CraPlugin	*plugin,
 							 CraPackage	*pkg,
 							 CraApp		*app,
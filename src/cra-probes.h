@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_PROBES_H
+#define __CRA_PROBES_H
+
+/*
+ * Static tracepoints that can be attached to with bpftrace or systemtap,
+ * e.g. usdt:./createrepo_as:createrepo_as:plugin__entry
+ *
+ * These are just a nop instruction when nothing is attached, and nothing
+ * at all (without evaluating the arguments) when built without sys/sdt.h.
+ * HAVE_SDT comes from config.h, which has to be included first.
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define CRA_PROBE1(name,a)		DTRACE_PROBE1(createrepo_as,name,a)
+#define CRA_PROBE2(name,a,b)		DTRACE_PROBE2(createrepo_as,name,a,b)
+#define CRA_PROBE3(name,a,b,c)		DTRACE_PROBE3(createrepo_as,name,a,b,c)
+#define CRA_PROBE4(name,a,b,c,d)	DTRACE_PROBE4(createrepo_as,name,a,b,c,d)
+#else
+#define CRA_PROBE1(name,a)		do { } while (0)
+#define CRA_PROBE2(name,a,b)		do { } while (0)
+#define CRA_PROBE3(name,a,b,c)		do { } while (0)
+#define CRA_PROBE4(name,a,b,c,d)	do { } while (0)
+#endif
+
+#endif /* __CRA_PROBES_H */
@@ -0,0 +1,544 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cra-cleanup.h"
+#include "cra-metrics.h"
+#include "cra-plugin.h"
+#include "cra-profile.h"
+
+typedef struct {
+	gchar		*name;
+	gdouble		 total;			/* in seconds */
+	guint		 calls;
+	GHashTable	*packages;		/* of name:CraProfileEntry */
+} CraProfileStage;
+
+typedef struct {
+	const gchar	*name;			/* owned by the hash table */
+	gdouble		 total;			/* in seconds */
+	guint		 calls;
+} CraProfileEntry;
+
+typedef struct {
+	pid_t		 pid;
+	gint		 tid;
+} CraProfileThread;
+
+static GMutex		 cra_profile_mutex;	/* for cra_profile_stages */
+static GHashTable	*cra_profile_stages = NULL;
+
+/* shared with the worker processes, so each event is a single write */
+static gint		 cra_profile_trace_fd = -1;
+static gint64		 cra_profile_trace_epoch = 0;
+static gint		 cra_profile_trace_threads = 0;
+static GPrivate		 cra_profile_trace_thread = G_PRIVATE_INIT (g_free);
+
+/**
+ * cra_profile_enabled:
+ *
+ * Profiling is turned on by setting CRA_PROFILE, which is only looked at
+ * once.
+ */
+gboolean
+cra_profile_enabled (void)
+{
+	static gsize once = 0;
+	static gboolean enabled = FALSE;
+
+	if (g_once_init_enter (&once)) {
+		enabled = g_getenv ("CRA_PROFILE") != NULL;
+		g_once_init_leave (&once, 1);
+	}
+	return enabled;
+}
+
+/**
+ * cra_profile_start:
+ *
+ * Returns the start time to pass to cra_profile_stop(), or 0 if profiling
+ * is not enabled.
+ */
+gint64
+cra_profile_start (void)
+{
+	if (!cra_profile_enabled () &&
+	    !cra_metrics_enabled () &&
+	    cra_profile_trace_fd < 0)
+		return 0;
+	return g_get_monotonic_time ();
+}
+
+/**
+ * cra_profile_stage_free:
+ */
+static void
+cra_profile_stage_free (CraProfileStage *stage)
+{
+	g_hash_table_unref (stage->packages);
+	g_free (stage->name);
+	g_free (stage);
+}
+
+/**
+ * cra_profile_add:
+ *
+ * The caller has to hold cra_profile_mutex.
+ */
+static void
+cra_profile_add (const gchar *stage_name,
+		 const gchar *pkg_name,
+		 gdouble elapsed,
+		 guint calls)
+{
+	CraProfileEntry *entry;
+	CraProfileStage *stage;
+	gchar *key;
+
+	if (cra_profile_stages == NULL) {
+		cra_profile_stages = g_hash_table_new_full (g_str_hash,
+							    g_str_equal,
+							    NULL,
+							    (GDestroyNotify)
+							    cra_profile_stage_free);
+	}
+	stage = g_hash_table_lookup (cra_profile_stages, stage_name);
+	if (stage == NULL) {
+		stage = g_new0 (CraProfileStage, 1);
+		stage->name = g_strdup (stage_name);
+		stage->packages = g_hash_table_new_full (g_str_hash,
+							 g_str_equal,
+							 g_free,
+							 g_free);
+		g_hash_table_insert (cra_profile_stages, stage->name, stage);
+	}
+	stage->total += elapsed;
+	stage->calls += calls;
+
+	entry = g_hash_table_lookup (stage->packages, pkg_name);
+	if (entry == NULL) {
+		key = g_strdup (pkg_name);
+		entry = g_new0 (CraProfileEntry, 1);
+		entry->name = key;
+		g_hash_table_insert (stage->packages, key, entry);
+	}
+	entry->total += elapsed;
+	entry->calls += calls;
+}
+
+/**
+ * cra_profile_trace_append_string:
+ */
+static void
+cra_profile_trace_append_string (GString *str, const gchar *value)
+{
+	const gchar *tmp;
+
+	g_string_append_c (str, '"');
+	for (tmp = value; *tmp != '\0'; tmp++) {
+		if (*tmp == '"' || *tmp == '\\')
+			g_string_append_c (str, '\\');
+		g_string_append_c (str, *tmp);
+	}
+	g_string_append_c (str, '"');
+}
+
+/**
+ * cra_profile_trace_write:
+ */
+static void
+cra_profile_trace_write (GString *str)
+{
+	const gchar *tmp = str->str;
+	gsize len = str->len;
+	gssize wrote;
+
+	while (len > 0) {
+		wrote = write (cra_profile_trace_fd, tmp, len);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0)
+			return;
+		tmp += wrote;
+		len -= wrote;
+	}
+}
+
+/**
+ * cra_profile_trace_get_tid:
+ *
+ * Gives each thread its own track, naming it the first time it is used.
+ * A forked worker process gets new tracks under its own pid.
+ */
+static gint
+cra_profile_trace_get_tid (void)
+{
+	CraProfileThread *thread;
+	_cleanup_string_free_ GString *str = NULL;
+
+	thread = g_private_get (&cra_profile_trace_thread);
+	if (thread != NULL && thread->pid == getpid ())
+		return thread->tid;
+	if (thread == NULL) {
+		thread = g_new0 (CraProfileThread, 1);
+		g_private_set (&cra_profile_trace_thread, thread);
+	}
+	thread->pid = getpid ();
+	thread->tid = g_atomic_int_add (&cra_profile_trace_threads, 1) + 1;
+
+	str = g_string_new ("{\"name\":\"thread_name\",\"ph\":\"M\",");
+	g_string_append_printf (str, "\"pid\":%i,\"tid\":%i,"
+				"\"args\":{\"name\":\"thread %i\"}},\n",
+				thread->pid, thread->tid, thread->tid);
+	cra_profile_trace_write (str);
+	return thread->tid;
+}
+
+/**
+ * cra_profile_trace_add:
+ */
+static void
+cra_profile_trace_add (const gchar *name,
+		       const gchar *pkg_name,
+		       gint64 start,
+		       gint64 end)
+{
+	gint tid;
+	_cleanup_string_free_ GString *str = NULL;
+
+	tid = cra_profile_trace_get_tid ();
+	str = g_string_new ("{\"name\":");
+	cra_profile_trace_append_string (str, name);
+	g_string_append_printf (str,
+				",\"cat\":\"cra\",\"ph\":\"X\","
+				"\"ts\":%" G_GINT64_FORMAT ","
+				"\"dur\":%" G_GINT64_FORMAT ","
+				"\"pid\":%i,\"tid\":%i",
+				start - cra_profile_trace_epoch,
+				end - start,
+				getpid (), tid);
+	if (pkg_name != NULL) {
+		g_string_append (str, ",\"args\":{\"package\":");
+		cra_profile_trace_append_string (str, pkg_name);
+		g_string_append_c (str, '}');
+	}
+	g_string_append (str, "},\n");
+	cra_profile_trace_write (str);
+}
+
+/**
+ * cra_profile_open_trace:
+ *
+ * Also writes each span to @filename as a Chrome trace event, which can be
+ * loaded into chrome://tracing or Perfetto.
+ */
+gboolean
+cra_profile_open_trace (const gchar *filename, GError **error)
+{
+	_cleanup_string_free_ GString *str = NULL;
+
+	cra_profile_trace_fd = open (filename,
+				     O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+				     0644);
+	if (cra_profile_trace_fd < 0) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to open %s: %s",
+			     filename, g_strerror (errno));
+		return FALSE;
+	}
+	cra_profile_trace_epoch = g_get_monotonic_time ();
+	str = g_string_new ("[\n");
+	cra_profile_trace_write (str);
+	return TRUE;
+}
+
+/**
+ * cra_profile_close_trace:
+ */
+void
+cra_profile_close_trace (void)
+{
+	_cleanup_string_free_ GString *str = NULL;
+
+	if (cra_profile_trace_fd < 0)
+		return;
+
+	/* every event ends with a comma, so finish with one more */
+	str = g_string_new (NULL);
+	g_string_append_printf (str,
+				"{\"name\":\"process_name\",\"ph\":\"M\","
+				"\"pid\":%i,\"args\":{\"name\":\"createrepo_as\"}}\n]\n",
+				getpid ());
+	cra_profile_trace_write (str);
+	close (cra_profile_trace_fd);
+	cra_profile_trace_fd = -1;
+}
+
+/**
+ * cra_profile_stop:
+ *
+ * Adds the time since @start to @stage, or to @stage of @plugin, for both
+ * the whole run and @pkg.
+ */
+void
+cra_profile_stop (gint64 start,
+		  CraPackage *pkg,
+		  const gchar *stage,
+		  const gchar *plugin)
+{
+	const gchar *pkg_name = NULL;
+	gdouble elapsed;
+	gint64 end;
+	_cleanup_free_ gchar *key = NULL;
+
+	if (start == 0)
+		return;
+	end = g_get_monotonic_time ();
+	elapsed = end - start;
+	elapsed /= G_USEC_PER_SEC;
+	if (pkg != NULL)
+		pkg_name = cra_package_get_name (pkg);
+	if (plugin != NULL)
+		key = g_strdup_printf ("%s:%s", stage, plugin);
+	if (cra_profile_trace_fd >= 0) {
+		cra_profile_trace_add (key != NULL ? key : stage,
+				       pkg_name, start, end);
+	}
+	cra_metrics_observe (CRA_METRIC_STAGE_SECONDS,
+			     key != NULL ? key : stage, elapsed);
+	if (!cra_profile_enabled ())
+		return;
+	g_mutex_lock (&cra_profile_mutex);
+	cra_profile_add (key != NULL ? key : stage,
+			 pkg_name != NULL ? pkg_name : "unknown",
+			 elapsed, 1);
+	g_mutex_unlock (&cra_profile_mutex);
+}
+
+/**
+ * cra_profile_reset:
+ */
+void
+cra_profile_reset (void)
+{
+	g_mutex_lock (&cra_profile_mutex);
+	if (cra_profile_stages != NULL)
+		g_hash_table_remove_all (cra_profile_stages);
+	g_mutex_unlock (&cra_profile_mutex);
+}
+
+/**
+ * cra_profile_to_string:
+ *
+ * Saves the timings so that a worker process can send them back to the
+ * coordinator, which adds them with cra_profile_add_from_string().
+ */
+GString *
+cra_profile_to_string (void)
+{
+	CraProfileEntry *entry;
+	CraProfileStage *stage;
+	GHashTableIter iter;
+	GHashTableIter iter_pkg;
+	GString *str;
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	str = g_string_new (NULL);
+	g_mutex_lock (&cra_profile_mutex);
+	if (cra_profile_stages == NULL)
+		goto out;
+	g_hash_table_iter_init (&iter, cra_profile_stages);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stage)) {
+		g_hash_table_iter_init (&iter_pkg, stage->packages);
+		while (g_hash_table_iter_next (&iter_pkg, NULL,
+					       (gpointer *) &entry)) {
+			/* read back with g_ascii_strtod() */
+			g_string_append_printf (str, "%s\t%s\t%s\t%u\n",
+						stage->name,
+						entry->name,
+						g_ascii_dtostr (buf, sizeof (buf),
+								entry->total),
+						entry->calls);
+		}
+	}
+out:
+	g_mutex_unlock (&cra_profile_mutex);
+	return str;
+}
+
+/**
+ * cra_profile_add_from_string:
+ */
+void
+cra_profile_add_from_string (const gchar *data, gsize len)
+{
+	guint i;
+	_cleanup_free_ gchar *tmp = NULL;
+	_cleanup_strv_free_ gchar **lines = NULL;
+
+	tmp = g_strndup (data, len);
+	lines = g_strsplit (tmp, "\n", -1);
+	g_mutex_lock (&cra_profile_mutex);
+	for (i = 0; lines[i] != NULL; i++) {
+		_cleanup_strv_free_ gchar **split = NULL;
+		split = g_strsplit (lines[i], "\t", -1);
+		if (g_strv_length (split) != 4)
+			continue;
+		cra_profile_add (split[0], split[1],
+				 g_ascii_strtod (split[2], NULL),
+				 g_ascii_strtoull (split[3], NULL, 10));
+	}
+	g_mutex_unlock (&cra_profile_mutex);
+}
+
+/**
+ * cra_profile_stage_cmp:
+ */
+static gint
+cra_profile_stage_cmp (gconstpointer a, gconstpointer b)
+{
+	CraProfileStage *stage_a = *((CraProfileStage **) a);
+	CraProfileStage *stage_b = *((CraProfileStage **) b);
+	if (stage_a->total > stage_b->total)
+		return -1;
+	if (stage_a->total < stage_b->total)
+		return 1;
+	return 0;
+}
+
+/**
+ * cra_profile_entry_cmp:
+ */
+static gint
+cra_profile_entry_cmp (gconstpointer a, gconstpointer b)
+{
+	CraProfileEntry *entry_a = *((CraProfileEntry **) a);
+	CraProfileEntry *entry_b = *((CraProfileEntry **) b);
+	if (entry_a->total > entry_b->total)
+		return -1;
+	if (entry_a->total < entry_b->total)
+		return 1;
+	return 0;
+}
+
+/**
+ * cra_profile_stage_get_entries:
+ *
+ * Returns the packages in the stage, slowest first.
+ */
+static GPtrArray *
+cra_profile_stage_get_entries (CraProfileStage *stage)
+{
+	CraProfileEntry *entry;
+	GHashTableIter iter;
+	GPtrArray *entries;
+
+	entries = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, stage->packages);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+		g_ptr_array_add (entries, entry);
+	g_ptr_array_sort (entries, cra_profile_entry_cmp);
+	return entries;
+}
+
+/**
+ * cra_profile_percentile:
+ *
+ * @entries has to be sorted, slowest first.
+ */
+static gdouble
+cra_profile_percentile (GPtrArray *entries, guint percentile)
+{
+	CraProfileEntry *entry;
+	guint idx;
+
+	idx = (entries->len * (100 - percentile)) / 100;
+	entry = g_ptr_array_index (entries, MIN (idx, entries->len - 1));
+	return entry->total;
+}
+
+/**
+ * cra_profile_report:
+ *
+ * Prints the total time in each stage, slowest first, with the percentiles
+ * of the time each package spent in it and the @top_n slowest packages.
+ */
+void
+cra_profile_report (guint top_n)
+{
+	CraProfileEntry *entry;
+	CraProfileStage *stage;
+	GHashTableIter iter;
+	guint i;
+	guint j;
+	_cleanup_ptrarray_unref_ GPtrArray *stages = NULL;
+
+	if (!cra_profile_enabled ())
+		return;
+	g_mutex_lock (&cra_profile_mutex);
+	if (cra_profile_stages == NULL)
+		goto out;
+	stages = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, cra_profile_stages);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stage))
+		g_ptr_array_add (stages, stage);
+	g_ptr_array_sort (stages, cra_profile_stage_cmp);
+
+	g_print ("%-32s %10s %8s %8s %8s %8s %8s\n",
+		 "Stage", "Total/s", "Calls", "p50/ms", "p90/ms",
+		 "p99/ms", "Max/ms");
+	for (i = 0; i < stages->len; i++) {
+		_cleanup_ptrarray_unref_ GPtrArray *entries = NULL;
+		stage = g_ptr_array_index (stages, i);
+		entries = cra_profile_stage_get_entries (stage);
+		if (entries->len == 0)
+			continue;
+		g_print ("%-32s %10.2f %8u %8.0f %8.0f %8.0f %8.0f\n",
+			 stage->name,
+			 stage->total,
+			 stage->calls,
+			 cra_profile_percentile (entries, 50) * 1000,
+			 cra_profile_percentile (entries, 90) * 1000,
+			 cra_profile_percentile (entries, 99) * 1000,
+			 cra_profile_percentile (entries, 100) * 1000);
+	}
+
+	/* where to throw hardware */
+	for (i = 0; i < stages->len; i++) {
+		_cleanup_ptrarray_unref_ GPtrArray *entries = NULL;
+		stage = g_ptr_array_index (stages, i);
+		entries = cra_profile_stage_get_entries (stage);
+		g_print ("\nSlowest packages for %s:\n", stage->name);
+		for (j = 0; j < entries->len && j < top_n; j++) {
+			entry = g_ptr_array_index (entries, j);
+			g_print (" %10.0fms  %s\n", entry->total * 1000, entry->name);
+		}
+	}
+out:
+	g_mutex_unlock (&cra_profile_mutex);
+}
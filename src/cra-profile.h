@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_PROFILE_H
+#define __CRA_PROFILE_H
+
+#include <glib.h>
+
+#include "cra-package.h"
+
+G_BEGIN_DECLS
+
+gboolean	 cra_profile_enabled			(void);
+gint64		 cra_profile_start			(void);
+void		 cra_profile_stop			(gint64		 start,
+							 CraPackage	*pkg,
+							 const gchar	*stage,
+							 const gchar	*plugin);
+void		 cra_profile_reset			(void);
+GString		*cra_profile_to_string			(void);
+void		 cra_profile_add_from_string		(const gchar	*data,
+							 gsize		 len);
+void		 cra_profile_report			(guint		 top_n);
+gboolean	 cra_profile_open_trace			(const gchar	*filename,
+							 GError		**error);
+void		 cra_profile_close_trace		(void);
+
+G_END_DECLS
+
+#endif /* __CRA_PROFILE_H */
@@ -0,0 +1,283 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cra-metrics.h"
+#include "cra-plugin.h"
+#include "cra-progress.h"
+
+struct CraProgress {
+	guint		 interval;		/* in seconds */
+	guint64		 counters[CRA_PROGRESS_COUNTER_LAST];
+	guint64		 total;			/* of packages to process */
+	GTimer		*timer;
+	FILE		*file;			/* JSON lines, or %NULL */
+	GThread		*thread;
+	gboolean	 done;
+	GMutex		 mutex;			/* for ->counters, ->total, ->done */
+	GCond		 cond;
+};
+
+/* used as the JSON keys */
+static const gchar *cra_progress_counter_names[] = {
+	"scanned",
+	"exploded",
+	"processed",
+	"apps",
+	"vetoed",
+	"bytes",
+	NULL };
+
+/**
+ * cra_progress_new:
+ */
+CraProgress *
+cra_progress_new (guint interval)
+{
+	CraProgress *progress;
+	progress = g_new0 (CraProgress, 1);
+	progress->interval = MAX (interval, 1);
+	progress->timer = g_timer_new ();
+	g_mutex_init (&progress->mutex);
+	g_cond_init (&progress->cond);
+	return progress;
+}
+
+/**
+ * cra_progress_free:
+ *
+ * Stops the reporter thread and reports the final counters.
+ */
+void
+cra_progress_free (CraProgress *progress)
+{
+	if (progress->thread != NULL) {
+		g_mutex_lock (&progress->mutex);
+		progress->done = TRUE;
+		g_cond_signal (&progress->cond);
+		g_mutex_unlock (&progress->mutex);
+		g_thread_join (progress->thread);
+	}
+	cra_progress_report (progress);
+	if (progress->file != NULL)
+		fclose (progress->file);
+	g_timer_destroy (progress->timer);
+	g_mutex_clear (&progress->mutex);
+	g_cond_clear (&progress->cond);
+	g_free (progress);
+}
+
+/**
+ * cra_progress_set_filename:
+ *
+ * Also writes each report to @filename, one JSON object per line.
+ */
+gboolean
+cra_progress_set_filename (CraProgress *progress,
+			   const gchar *filename,
+			   GError **error)
+{
+	progress->file = fopen (filename, "w");
+	if (progress->file == NULL) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to open %s: %s",
+			     filename, g_strerror (errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * cra_progress_set_total:
+ *
+ * Sets the number of packages to process, and restarts the clock.
+ */
+void
+cra_progress_set_total (CraProgress *progress, guint64 total)
+{
+	g_mutex_lock (&progress->mutex);
+	progress->total = total;
+	g_timer_reset (progress->timer);
+	g_mutex_unlock (&progress->mutex);
+}
+
+/**
+ * cra_progress_add:
+ */
+void
+cra_progress_add (CraProgress *progress,
+		  CraProgressCounter counter,
+		  guint64 value)
+{
+	g_mutex_lock (&progress->mutex);
+	progress->counters[counter] += value;
+	g_mutex_unlock (&progress->mutex);
+}
+
+/**
+ * cra_progress_write_metrics:
+ *
+ * The metrics file is rewritten at the same interval as the reports.
+ */
+static void
+cra_progress_write_metrics (guint64 *counters, gdouble elapsed)
+{
+	_cleanup_error_free_ GError *error = NULL;
+
+	if (!cra_metrics_enabled ())
+		return;
+	cra_metrics_set (CRA_METRIC_PACKAGES, "scanned",
+			 counters[CRA_PROGRESS_COUNTER_SCANNED]);
+	cra_metrics_set (CRA_METRIC_PACKAGES, "exploded",
+			 counters[CRA_PROGRESS_COUNTER_EXPLODED]);
+	cra_metrics_set (CRA_METRIC_PACKAGES, "processed",
+			 counters[CRA_PROGRESS_COUNTER_PROCESSED]);
+	cra_metrics_set (CRA_METRIC_APPS, "accepted",
+			 counters[CRA_PROGRESS_COUNTER_APPS]);
+	cra_metrics_set (CRA_METRIC_APPS, "vetoed",
+			 counters[CRA_PROGRESS_COUNTER_VETOED]);
+	cra_metrics_set (CRA_METRIC_EXTRACTED_BYTES, NULL,
+			 counters[CRA_PROGRESS_COUNTER_BYTES]);
+	cra_metrics_set (CRA_METRIC_ELAPSED, NULL, elapsed);
+	if (!cra_metrics_write (&error))
+		g_warning ("failed to write metrics: %s", error->message);
+}
+
+/**
+ * cra_progress_report:
+ *
+ * Prints the processing rate and how long is left, and writes all the
+ * counters to the JSON file if one was set.
+ */
+void
+cra_progress_report (CraProgress *progress)
+{
+	gdouble elapsed;
+	gdouble eta = -1.f;
+	gdouble rate = 0.f;
+	guint64 counters[CRA_PROGRESS_COUNTER_LAST];
+	guint64 processed;
+	guint64 total;
+	guint i;
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+	_cleanup_free_ gchar *size = NULL;
+
+	g_mutex_lock (&progress->mutex);
+	memcpy (counters, progress->counters, sizeof (counters));
+	total = progress->total;
+	elapsed = g_timer_elapsed (progress->timer, NULL);
+	g_mutex_unlock (&progress->mutex);
+	cra_progress_write_metrics (counters, elapsed);
+
+	/* nothing was processed, e.g. when merging */
+	processed = counters[CRA_PROGRESS_COUNTER_PROCESSED];
+	if (total == 0 && processed == 0)
+		return;
+	if (elapsed > 0.f)
+		rate = processed / elapsed;
+	if (rate > 0.f && total >= processed)
+		eta = (total - processed) / rate;
+
+	size = g_format_size (counters[CRA_PROGRESS_COUNTER_BYTES]);
+	if (eta >= 0.f) {
+		g_print ("Processed %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT
+			 " packages, %.1f/s, ETA %02u:%02u:%02u, "
+			 "%" G_GUINT64_FORMAT " apps, "
+			 "%" G_GUINT64_FORMAT " vetoed, %s exploded\n",
+			 processed, total, rate,
+			 (guint) eta / 3600,
+			 ((guint) eta / 60) % 60,
+			 (guint) eta % 60,
+			 counters[CRA_PROGRESS_COUNTER_APPS],
+			 counters[CRA_PROGRESS_COUNTER_VETOED],
+			 size);
+	} else {
+		g_print ("Processed %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT
+			 " packages, %" G_GUINT64_FORMAT " apps, "
+			 "%" G_GUINT64_FORMAT " vetoed, %s exploded\n",
+			 processed, total,
+			 counters[CRA_PROGRESS_COUNTER_APPS],
+			 counters[CRA_PROGRESS_COUNTER_VETOED],
+			 size);
+	}
+
+	/* for dashboards, which want a '.' whatever the locale */
+	if (progress->file == NULL)
+		return;
+	fprintf (progress->file, "{\"elapsed\":%s,\"total\":%" G_GUINT64_FORMAT,
+		 g_ascii_formatd (buf, sizeof (buf), "%.3f", elapsed), total);
+	for (i = 0; cra_progress_counter_names[i] != NULL; i++) {
+		fprintf (progress->file, ",\"%s\":%" G_GUINT64_FORMAT,
+			 cra_progress_counter_names[i], counters[i]);
+	}
+	fprintf (progress->file, ",\"rate\":%s",
+		 g_ascii_formatd (buf, sizeof (buf), "%.3f", rate));
+	fprintf (progress->file, ",\"eta\":%s}\n",
+		 g_ascii_formatd (buf, sizeof (buf), "%.0f", eta));
+	fflush (progress->file);
+}
+
+/**
+ * cra_progress_thread_func:
+ */
+static gpointer
+cra_progress_thread_func (gpointer data)
+{
+	CraProgress *progress = (CraProgress *) data;
+	gint64 end_time;
+
+	g_mutex_lock (&progress->mutex);
+	end_time = g_get_monotonic_time () +
+		   progress->interval * G_USEC_PER_SEC;
+	while (!progress->done) {
+		if (g_cond_wait_until (&progress->cond, &progress->mutex, end_time))
+			continue;
+		g_mutex_unlock (&progress->mutex);
+		cra_progress_report (progress);
+		g_mutex_lock (&progress->mutex);
+		end_time = g_get_monotonic_time () +
+			   progress->interval * G_USEC_PER_SEC;
+	}
+	g_mutex_unlock (&progress->mutex);
+	return NULL;
+}
+
+/**
+ * cra_progress_start:
+ *
+ * Starts a thread that reports the progress every interval. This cannot be
+ * used before worker processes are forked; call cra_progress_report() from
+ * the main loop instead.
+ */
+void
+cra_progress_start (CraProgress *progress)
+{
+	progress->thread = g_thread_new ("progress",
+					 cra_progress_thread_func,
+					 progress);
+}
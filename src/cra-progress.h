@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_PROGRESS_H
+#define __CRA_PROGRESS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct	CraProgress		CraProgress;
+
+typedef enum {
+	CRA_PROGRESS_COUNTER_SCANNED,
+	CRA_PROGRESS_COUNTER_EXPLODED,
+	CRA_PROGRESS_COUNTER_PROCESSED,
+	CRA_PROGRESS_COUNTER_APPS,
+	CRA_PROGRESS_COUNTER_VETOED,
+	CRA_PROGRESS_COUNTER_BYTES,
+	CRA_PROGRESS_COUNTER_LAST
+} CraProgressCounter;
+
+CraProgress	*cra_progress_new			(guint		 interval);
+void		 cra_progress_free			(CraProgress	*progress);
+gboolean	 cra_progress_set_filename		(CraProgress	*progress,
+							 const gchar	*filename,
+							 GError		**error);
+void		 cra_progress_set_total			(CraProgress	*progress,
+							 guint64	 total);
+void		 cra_progress_add			(CraProgress	*progress,
+							 CraProgressCounter counter,
+							 guint64	 value);
+void		 cra_progress_report			(CraProgress	*progress);
+void		 cra_progress_start			(CraProgress	*progress);
+
+G_END_DECLS
+
+#endif /* __CRA_PROGRESS_H */
@@ -0,0 +1,279 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "cra-app.h"
+#include "cra-store.h"
+
+struct CraStore {
+	GPtrArray	*apps;		/* of AsApp, NULL when removed */
+	GHashTable	*positions;	/* of AsApp : index in ->apps + 1 */
+	GHashTable	*id_index;	/* of id_full : GPtrArray of AsApp */
+	GHashTable	*md_indexes;	/* of key : GHashTable of value : GPtrArray */
+	guint		 nr_removed;
+};
+
+/**
+ * cra_store_new:
+ */
+CraStore *
+cra_store_new (void)
+{
+	CraStore *store;
+	store = g_new0 (CraStore, 1);
+	store->apps = g_ptr_array_new ();
+	store->positions = g_hash_table_new (g_direct_hash, g_direct_equal);
+	store->id_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 g_free, (GDestroyNotify) g_ptr_array_unref);
+	store->md_indexes = g_hash_table_new_full (g_str_hash, g_str_equal,
+						   g_free, (GDestroyNotify) g_hash_table_unref);
+	return store;
+}
+
+/**
+ * cra_store_free:
+ */
+void
+cra_store_free (CraStore *store)
+{
+	AsApp *app;
+	guint i;
+
+	for (i = 0; i < store->apps->len; i++) {
+		app = g_ptr_array_index (store->apps, i);
+		if (app != NULL)
+			g_object_unref (app);
+	}
+	g_ptr_array_unref (store->apps);
+	g_hash_table_unref (store->positions);
+	g_hash_table_unref (store->id_index);
+	g_hash_table_unref (store->md_indexes);
+	g_free (store);
+}
+
+/**
+ * cra_store_add_to_id_index:
+ */
+static void
+cra_store_add_to_id_index (CraStore *store, AsApp *app)
+{
+	GPtrArray *array;
+	const gchar *id_full;
+
+	id_full = as_app_get_id_full (app);
+	if (id_full == NULL)
+		return;
+	array = g_hash_table_lookup (store->id_index, id_full);
+	if (array == NULL) {
+		array = g_ptr_array_new ();
+		g_hash_table_insert (store->id_index, g_strdup (id_full), array);
+	}
+	g_ptr_array_add (array, app);
+}
+
+/**
+ * cra_store_add_app:
+ */
+void
+cra_store_add_app (CraStore *store, AsApp *app)
+{
+	/* the metadata indexes are rebuilt when next asked for */
+	g_hash_table_remove_all (store->md_indexes);
+
+	g_ptr_array_add (store->apps, g_object_ref (app));
+	g_hash_table_insert (store->positions, app,
+			     GUINT_TO_POINTER (store->apps->len));
+	cra_store_add_to_id_index (store, app);
+}
+
+/**
+ * cra_store_remove_app:
+ *
+ * The slot is only cleared here, and the array is compacted in one pass when
+ * the applications are next asked for.
+ */
+void
+cra_store_remove_app (CraStore *store, AsApp *app)
+{
+	GPtrArray *array;
+	const gchar *id_full;
+	guint idx;
+
+	idx = GPOINTER_TO_UINT (g_hash_table_lookup (store->positions, app));
+	if (idx == 0)
+		return;
+	g_hash_table_remove (store->positions, app);
+	g_hash_table_remove_all (store->md_indexes);
+
+	/* remove from the id index */
+	id_full = as_app_get_id_full (app);
+	if (id_full != NULL) {
+		array = g_hash_table_lookup (store->id_index, id_full);
+		if (array != NULL) {
+			g_ptr_array_remove (array, app);
+			if (array->len == 0)
+				g_hash_table_remove (store->id_index, id_full);
+		}
+	}
+
+	/* clear the slot */
+	g_ptr_array_index (store->apps, idx - 1) = NULL;
+	store->nr_removed++;
+	g_object_unref (app);
+}
+
+/**
+ * cra_store_compact:
+ */
+static void
+cra_store_compact (CraStore *store)
+{
+	AsApp *app;
+	guint i;
+	guint j = 0;
+
+	if (store->nr_removed == 0)
+		return;
+	for (i = 0; i < store->apps->len; i++) {
+		app = g_ptr_array_index (store->apps, i);
+		if (app == NULL)
+			continue;
+		g_ptr_array_index (store->apps, j++) = app;
+		g_hash_table_insert (store->positions, app,
+				     GUINT_TO_POINTER (j));
+	}
+	g_ptr_array_set_size (store->apps, j);
+	store->nr_removed = 0;
+}
+
+/**
+ * cra_store_sort:
+ *
+ * Sorts the applications, which also changes the order of the applications
+ * in each group of the ID and metadata indexes.
+ */
+void
+cra_store_sort (CraStore *store, GCompareFunc func)
+{
+	AsApp *app;
+	guint i;
+
+	cra_store_compact (store);
+	g_ptr_array_sort (store->apps, func);
+	g_hash_table_remove_all (store->id_index);
+	g_hash_table_remove_all (store->md_indexes);
+	for (i = 0; i < store->apps->len; i++) {
+		app = g_ptr_array_index (store->apps, i);
+		g_hash_table_insert (store->positions, app,
+				     GUINT_TO_POINTER (i + 1));
+		cra_store_add_to_id_index (store, app);
+	}
+}
+
+/**
+ * cra_store_get_size:
+ */
+guint
+cra_store_get_size (CraStore *store)
+{
+	return store->apps->len - store->nr_removed;
+}
+
+/**
+ * cra_store_get_apps:
+ *
+ * Returns the applications in the order they were added, unless the store
+ * has been sorted since. The array is owned by the store and is only valid
+ * until the store is next modified.
+ */
+GPtrArray *
+cra_store_get_apps (CraStore *store)
+{
+	cra_store_compact (store);
+	return store->apps;
+}
+
+/**
+ * cra_store_get_apps_by_id:
+ */
+GPtrArray *
+cra_store_get_apps_by_id (CraStore *store, const gchar *id_full)
+{
+	return g_hash_table_lookup (store->id_index, id_full);
+}
+
+/**
+ * cra_store_get_id_index:
+ *
+ * Returns a hash table of id_full to a #GPtrArray of the applications with
+ * that ID, in the order they were added.
+ */
+GHashTable *
+cra_store_get_id_index (CraStore *store)
+{
+	return store->id_index;
+}
+
+/**
+ * cra_store_get_metadata_index:
+ *
+ * Returns a hash table of metadata value to a #GPtrArray of the #CraApp's
+ * that have @key set to that value, in the order they were added.
+ *
+ * The index is built the first time it is asked for and is dropped when any
+ * application is added or removed, so it should be requested again after
+ * modifying the store. Applications that are not #CraApp's are not indexed.
+ */
+GHashTable *
+cra_store_get_metadata_index (CraStore *store, const gchar *key)
+{
+	AsApp *app;
+	GHashTable *index;
+	GPtrArray *array;
+	const gchar *value;
+	guint i;
+
+	/* already built */
+	index = g_hash_table_lookup (store->md_indexes, key);
+	if (index != NULL)
+		return index;
+
+	/* build in one pass */
+	index = g_hash_table_new_full (g_str_hash, g_str_equal,
+				       g_free, (GDestroyNotify) g_ptr_array_unref);
+	for (i = 0; i < store->apps->len; i++) {
+		app = g_ptr_array_index (store->apps, i);
+		if (app == NULL || !CRA_IS_APP (app))
+			continue;
+		value = as_app_get_metadata_item (app, key);
+		if (value == NULL)
+			continue;
+		array = g_hash_table_lookup (index, value);
+		if (array == NULL) {
+			array = g_ptr_array_new ();
+			g_hash_table_insert (index, g_strdup (value), array);
+		}
+		g_ptr_array_add (array, app);
+	}
+	g_hash_table_insert (store->md_indexes, g_strdup (key), index);
+	return index;
+}
@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_STORE_H
+#define __CRA_STORE_H
+
+#include <glib.h>
+#include <appstream-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct	CraStore		CraStore;
+
+CraStore	*cra_store_new			(void);
+void		 cra_store_free			(CraStore	*store);
+void		 cra_store_add_app		(CraStore	*store,
+						 AsApp		*app);
+void		 cra_store_remove_app		(CraStore	*store,
+						 AsApp		*app);
+void		 cra_store_sort			(CraStore	*store,
+						 GCompareFunc	 func);
+guint		 cra_store_get_size		(CraStore	*store);
+GPtrArray	*cra_store_get_apps		(CraStore	*store);
+GPtrArray	*cra_store_get_apps_by_id	(CraStore	*store,
+						 const gchar	*id_full);
+GHashTable	*cra_store_get_id_index		(CraStore	*store);
+GHashTable	*cra_store_get_metadata_index	(CraStore	*store,
+						 const gchar	*key);
+
+G_END_DECLS
+
+#endif /* __CRA_STORE_H */
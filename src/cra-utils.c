@@ -26,8 +26,10 @@
 #include <archive.h>
 #include <archive_entry.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "cra-cleanup.h"
+#include "cra-memory.h"
 #include "cra-utils.h"
 #include "cra-plugin.h"
 
@@ -188,6 +190,7 @@ cra_utils_explode (const gchar *filename,
 	ret = g_file_get_contents (filename, &data, &len, error);
 	if (!ret)
 		goto out;
+	cra_memory_add ("explode-buffer", len);
 
 	/* read anything */
 	arch = archive_read_new ();
@@ -239,6 +242,8 @@ out:
 		archive_read_close (arch);
 		archive_read_free (arch);
 	}
+	if (data != NULL)
+		cra_memory_add ("explode-buffer", -(gint64) len);
 	return ret;
 }
 
@@ -325,31 +330,31 @@ out:
  * cra_utils_add_apps_from_file:
  */
 gboolean
-cra_utils_add_apps_from_file (GList **apps, const gchar *filename, GError **error)
+cra_utils_add_apps_from_file (CraStore *store, const gchar *filename, GError **error)
 {
 	AsApp *app;
-	AsStore *store;
+	AsStore *as_store;
 	GFile *file;
 	GPtrArray *array;
 	gboolean ret;
 	guint i;
 
 	/* parse file */
-	store = as_store_new ();
+	as_store = as_store_new ();
 	file = g_file_new_for_path (filename);
-	ret = as_store_from_file (store, file, NULL, NULL, error);
+	ret = as_store_from_file (as_store, file, NULL, NULL, error);
 	if (!ret)
 		goto out;
 
 	/* copy Asapp's into CraApp's */
-	array = as_store_get_apps (store);
+	array = as_store_get_apps (as_store);
 	for (i = 0; i < array->len; i++) {
 		app = g_ptr_array_index (array, i);
-		cra_plugin_add_app (apps, (CraApp *) app);
+		cra_store_add_app (store, app);
 	}
 out:
 	g_object_unref (file);
-	g_object_unref (store);
+	g_object_unref (as_store);
 	return ret;
 }
 
@@ -357,7 +362,7 @@ out:
  * cra_utils_add_apps_from_dir:
  */
 gboolean
-cra_utils_add_apps_from_dir (GList **apps, const gchar *path, GError **error)
+cra_utils_add_apps_from_dir (CraStore *store, const gchar *path, GError **error)
 {
 	const gchar *tmp;
 	gboolean ret = TRUE;
@@ -371,7 +376,7 @@ cra_utils_add_apps_from_dir (GList **apps, const gchar *path, GError **error)
 	}
 	while ((tmp = g_dir_read_name (dir)) != NULL) {
 		filename = g_build_filename (path, tmp, NULL);
-		ret = cra_utils_add_apps_from_file (apps, filename, error);
+		ret = cra_utils_add_apps_from_file (store, filename, error);
 		g_free (filename);
 		if (!ret)
 			goto out;
@@ -409,6 +414,120 @@ out:
 
 /******************************************************************************/
 
+/**
+ * cra_utils_get_cgroup_dirs:
+ *
+ * Returns the cgroup v2 directories of this process, starting with its own
+ * and ending with the root, as a limit set on any of them applies to us.
+ */
+static gchar **
+cra_utils_get_cgroup_dirs (void)
+{
+	GPtrArray *dirs;
+	gchar *tmp;
+	guint i;
+	_cleanup_free_ gchar *data = NULL;
+	_cleanup_free_ gchar *path = NULL;
+	_cleanup_strv_free_ gchar **lines = NULL;
+
+	/* the unified hierarchy is the "0::/path" line */
+	if (g_file_get_contents ("/proc/self/cgroup", &data, NULL, NULL)) {
+		lines = g_strsplit (data, "\n", -1);
+		for (i = 0; lines[i] != NULL; i++) {
+			if (g_str_has_prefix (lines[i], "0::/")) {
+				path = g_strdup (lines[i] + 4);
+				break;
+			}
+		}
+	}
+
+	dirs = g_ptr_array_new ();
+	while (path != NULL && path[0] != '\0') {
+		g_ptr_array_add (dirs, g_build_filename ("/sys/fs/cgroup", path, NULL));
+		tmp = g_strrstr (path, "/");
+		if (tmp == NULL)
+			break;
+		*tmp = '\0';
+	}
+	g_ptr_array_add (dirs, g_strdup ("/sys/fs/cgroup"));
+	g_ptr_array_add (dirs, NULL);
+	return (gchar **) g_ptr_array_free (dirs, FALSE);
+}
+
+/**
+ * cra_utils_get_cpu_quota:
+ *
+ * Returns the number of CPUs we are allowed to use, which is limited by the
+ * tightest cgroup v2 CPU quota when running in a container.
+ */
+guint
+cra_utils_get_cpu_quota (void)
+{
+	guint64 period;
+	guint64 quota;
+	guint i;
+	guint nr_cpus;
+	_cleanup_strv_free_ gchar **dirs = NULL;
+
+	nr_cpus = g_get_num_processors ();
+	dirs = cra_utils_get_cgroup_dirs ();
+	for (i = 0; dirs[i] != NULL; i++) {
+		_cleanup_free_ gchar *data = NULL;
+		_cleanup_free_ gchar *filename = NULL;
+		_cleanup_strv_free_ gchar **split = NULL;
+
+		filename = g_build_filename (dirs[i], "cpu.max", NULL);
+		if (!g_file_get_contents (filename, &data, NULL, NULL))
+			continue;
+
+		/* this is "$MAX $PERIOD" where $MAX can be "max" */
+		split = g_strsplit (g_strstrip (data), " ", -1);
+		if (g_strv_length (split) != 2 || g_strcmp0 (split[0], "max") == 0)
+			continue;
+		quota = g_ascii_strtoull (split[0], NULL, 10);
+		period = g_ascii_strtoull (split[1], NULL, 10);
+		if (quota == 0 || period == 0)
+			continue;
+		nr_cpus = CLAMP ((quota + period - 1) / period, 1, nr_cpus);
+	}
+	return nr_cpus;
+}
+
+/**
+ * cra_utils_get_memory_limit:
+ *
+ * Returns the number of bytes of memory we are allowed to use, which is
+ * limited by the tightest cgroup v2 memory limit when running in a container.
+ */
+guint64
+cra_utils_get_memory_limit (void)
+{
+	guint64 limit;
+	guint64 physical;
+	guint i;
+	_cleanup_strv_free_ gchar **dirs = NULL;
+
+	physical = (guint64) sysconf (_SC_PHYS_PAGES) *
+		   (guint64) sysconf (_SC_PAGESIZE);
+	dirs = cra_utils_get_cgroup_dirs ();
+	for (i = 0; dirs[i] != NULL; i++) {
+		_cleanup_free_ gchar *data = NULL;
+		_cleanup_free_ gchar *filename = NULL;
+
+		filename = g_build_filename (dirs[i], "memory.max", NULL);
+		if (!g_file_get_contents (filename, &data, NULL, NULL))
+			continue;
+		g_strstrip (data);
+		if (g_strcmp0 (data, "max") == 0)
+			continue;
+		limit = g_ascii_strtoull (data, NULL, 10);
+		if (limit == 0)
+			continue;
+		physical = MIN (limit, physical);
+	}
+	return physical;
+}
+
 struct CraGlobValue {
 	gchar		*glob;
 	gchar		*value;
@@ -25,6 +25,8 @@
 #include <glib.h>
 #include <appstream-glib.h>
 
+#include "cra-store.h"
+
 G_BEGIN_DECLS
 
 typedef struct	CraGlobValue		CraGlobValue;
@@ -41,6 +43,8 @@ gboolean	 cra_utils_explode			(const gchar	*filename,
 							 GPtrArray	*glob,
 							 GError		**error);
 gchar		*cra_utils_get_cache_id_for_filename	(const gchar	*filename);
+guint		 cra_utils_get_cpu_quota		(void);
+guint64		 cra_utils_get_memory_limit		(void);
 
 CraGlobValue	*cra_glob_value_new			(const gchar	*glob,
 							 const gchar	*value);
@@ -52,10 +56,10 @@ guint		 cra_string_replace			(GString	*string,
 							 const gchar	*search,
 							 const gchar	*replace);
 
-gboolean	 cra_utils_add_apps_from_file		(GList		**apps,
+gboolean	 cra_utils_add_apps_from_file		(CraStore	*store,
 							 const gchar	*filename,
 							 GError		**error);
-gboolean	 cra_utils_add_apps_from_dir		(GList		**apps,
+gboolean	 cra_utils_add_apps_from_dir		(CraStore	*store,
 							 const gchar	*path,
 							 GError		**error);
 
@@ -0,0 +1,208 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "cra-cleanup.h"
+#include "cra-watchdog.h"
+
+typedef struct {
+	CraPackage	*pkg;
+	gint64		 start;
+} CraWatchdogItem;
+
+struct CraWatchdog {
+	guint		 package_timeout;	/* in seconds, or 0 for none */
+	guint		 plugin_timeout;	/* in seconds, or 0 for none */
+	GThread		*thread;		/* started on demand */
+	GPtrArray	*items;			/* of CraWatchdogItem */
+	gboolean	 done;
+	GMutex		 mutex;			/* for ->items and ->done */
+	GCond		 cond;
+};
+
+/**
+ * cra_watchdog_new:
+ */
+CraWatchdog *
+cra_watchdog_new (guint package_timeout, guint plugin_timeout)
+{
+	CraWatchdog *watchdog;
+	watchdog = g_new0 (CraWatchdog, 1);
+	watchdog->package_timeout = package_timeout;
+	watchdog->plugin_timeout = plugin_timeout;
+	watchdog->items = g_ptr_array_new_with_free_func (g_free);
+	g_mutex_init (&watchdog->mutex);
+	g_cond_init (&watchdog->cond);
+	return watchdog;
+}
+
+/**
+ * cra_watchdog_free:
+ */
+void
+cra_watchdog_free (CraWatchdog *watchdog)
+{
+	if (watchdog->thread != NULL) {
+		g_mutex_lock (&watchdog->mutex);
+		watchdog->done = TRUE;
+		g_cond_signal (&watchdog->cond);
+		g_mutex_unlock (&watchdog->mutex);
+		g_thread_join (watchdog->thread);
+	}
+	g_ptr_array_unref (watchdog->items);
+	g_mutex_clear (&watchdog->mutex);
+	g_cond_clear (&watchdog->cond);
+	g_free (watchdog);
+}
+
+/**
+ * cra_watchdog_check:
+ *
+ * Cancels the package if it has gone over either budget. The task notices
+ * this the next time it checks, and gives up on the rest of the package.
+ *
+ * Returns: the warning to show once the lock is dropped, or %NULL
+ */
+static gchar *
+cra_watchdog_check (CraWatchdog *watchdog, CraWatchdogItem *item)
+{
+	GCancellable *cancellable;
+	const gchar *plugin;
+	const gchar *stage;
+	gdouble elapsed;
+	gdouble elapsed_plugin;
+
+	cancellable = cra_package_get_cancellable (item->pkg);
+	if (g_cancellable_is_cancelled (cancellable))
+		return NULL;
+	elapsed = g_get_monotonic_time () - item->start;
+	elapsed /= G_USEC_PER_SEC;
+	elapsed_plugin = cra_package_get_stage (item->pkg, &plugin, &stage);
+	if (watchdog->package_timeout > 0 &&
+	    elapsed > watchdog->package_timeout) {
+		cra_package_log (item->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "Abandoned after %.0fs, over the %us "
+				 "package budget", elapsed,
+				 watchdog->package_timeout);
+	} else if (watchdog->plugin_timeout > 0 && plugin != NULL &&
+		   elapsed_plugin > watchdog->plugin_timeout) {
+		cra_package_log (item->pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "Abandoned after %.0fs in %s, over the %us "
+				 "plugin budget", elapsed_plugin, plugin,
+				 watchdog->plugin_timeout);
+	} else {
+		return NULL;
+	}
+	cra_package_log (item->pkg,
+			 CRA_PACKAGE_LOG_LEVEL_WARNING,
+			 "Was in the %s stage of %s",
+			 stage != NULL ? stage : "unknown",
+			 plugin != NULL ? plugin : "createrepo_as");
+	g_cancellable_cancel (cancellable);
+	return g_strdup_printf ("%s timed out in the %s stage of %s",
+				cra_package_get_nevr (item->pkg),
+				stage != NULL ? stage : "unknown",
+				plugin != NULL ? plugin : "createrepo_as");
+}
+
+/**
+ * cra_watchdog_thread_func:
+ */
+static gpointer
+cra_watchdog_thread_func (gpointer data)
+{
+	CraWatchdog *watchdog = (CraWatchdog *) data;
+	gchar *tmp;
+	gint64 end_time;
+	guint i;
+	_cleanup_ptrarray_unref_ GPtrArray *warnings = NULL;
+
+	warnings = g_ptr_array_new_with_free_func (g_free);
+	g_mutex_lock (&watchdog->mutex);
+	while (!watchdog->done) {
+		end_time = g_get_monotonic_time () + G_USEC_PER_SEC / 4;
+		g_cond_wait_until (&watchdog->cond, &watchdog->mutex, end_time);
+		for (i = 0; i < watchdog->items->len; i++) {
+			tmp = cra_watchdog_check (watchdog, g_ptr_array_index (watchdog->items, i));
+			if (tmp != NULL)
+				g_ptr_array_add (warnings, tmp);
+		}
+		if (warnings->len == 0)
+			continue;
+
+		/* a log handler could block, so don't hold up the tasks */
+		g_mutex_unlock (&watchdog->mutex);
+		for (i = 0; i < warnings->len; i++)
+			g_warning ("%s", (const gchar *) g_ptr_array_index (warnings, i));
+		g_ptr_array_set_size (warnings, 0);
+		g_mutex_lock (&watchdog->mutex);
+	}
+	g_mutex_unlock (&watchdog->mutex);
+	return NULL;
+}
+
+/**
+ * cra_watchdog_add:
+ *
+ * Starts timing the package. The thread is only started when the first
+ * package is added, so that a worker pool can still be forked after the
+ * watchdog has been created.
+ */
+void
+cra_watchdog_add (CraWatchdog *watchdog, CraPackage *pkg)
+{
+	CraWatchdogItem *item;
+
+	item = g_new0 (CraWatchdogItem, 1);
+	item->pkg = pkg;
+	item->start = g_get_monotonic_time ();
+	g_mutex_lock (&watchdog->mutex);
+	g_ptr_array_add (watchdog->items, item);
+	if (watchdog->thread == NULL) {
+		watchdog->thread = g_thread_new ("watchdog",
+						 cra_watchdog_thread_func,
+						 watchdog);
+	}
+	g_mutex_unlock (&watchdog->mutex);
+}
+
+/**
+ * cra_watchdog_remove:
+ */
+void
+cra_watchdog_remove (CraWatchdog *watchdog, CraPackage *pkg)
+{
+	CraWatchdogItem *item;
+	guint i;
+
+	g_mutex_lock (&watchdog->mutex);
+	for (i = 0; i < watchdog->items->len; i++) {
+		item = g_ptr_array_index (watchdog->items, i);
+		if (item->pkg == pkg) {
+			g_ptr_array_remove_index_fast (watchdog->items, i);
+			break;
+		}
+	}
+	g_mutex_unlock (&watchdog->mutex);
+}
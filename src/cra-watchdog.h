@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_WATCHDOG_H
+#define __CRA_WATCHDOG_H
+
+#include <glib.h>
+
+#include "cra-package.h"
+
+G_BEGIN_DECLS
+
+typedef struct	CraWatchdog		CraWatchdog;
+
+CraWatchdog	*cra_watchdog_new			(guint		 package_timeout,
+							 guint		 plugin_timeout);
+void		 cra_watchdog_free			(CraWatchdog	*watchdog);
+void		 cra_watchdog_add			(CraWatchdog	*watchdog,
+							 CraPackage	*pkg);
+void		 cra_watchdog_remove			(CraWatchdog	*watchdog,
+							 CraPackage	*pkg);
+
+G_END_DECLS
+
+#endif /* __CRA_WATCHDOG_H */
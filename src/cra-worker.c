@@ -0,0 +1,522 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <glib-unix.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cra-cleanup.h"
+#include "cra-plugin.h"
+#include "cra-worker.h"
+
+typedef struct CraWorkerPool	CraWorkerPool;
+
+typedef struct {
+	CraWorkerPool	*pool;
+	GPid		 pid;
+	gint		 fd_jobs;	/* to the worker */
+	gint		 fd_results;	/* from the worker */
+	guint		 watch_id;
+	gint		 job;		/* or -1 when idle */
+	gint64		 job_start;
+	gboolean	 timed_out;
+	GByteArray	*buf;
+} CraWorker;
+
+struct CraWorkerPool {
+	CraWorker		*workers;
+	guint			 nr_workers;
+	guint			 nr_jobs;
+	guint			 nr_done;
+	guint			 next_job;
+	guint			 timeout;	/* in seconds, or 0 for none */
+	GQueue			 retry;		/* of job + 1 */
+	CraWorkerFunc		 func;
+	CraWorkerResultFunc	 result_func;
+	CraWorkerAdmitFunc	 admit_func;	/* or %NULL */
+	gpointer		 user_data;
+	GMainLoop		*loop;
+	GError			*error;
+};
+
+/* sent before each result */
+typedef struct {
+	guint32		 job;
+	guint32		 len;
+} CraWorkerHeader;
+
+static gboolean	cra_worker_spawn (CraWorker *worker, GError **error);
+
+/**
+ * cra_worker_write_all:
+ */
+static gboolean
+cra_worker_write_all (gint fd, gconstpointer data, gsize len)
+{
+	const guint8 *tmp = data;
+	gssize wrote;
+
+	while (len > 0) {
+		wrote = write (fd, tmp, len);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0)
+			return FALSE;
+		tmp += wrote;
+		len -= wrote;
+	}
+	return TRUE;
+}
+
+/**
+ * cra_worker_read_all:
+ */
+static gboolean
+cra_worker_read_all (gint fd, gpointer data, gsize len)
+{
+	guint8 *tmp = data;
+	gssize got;
+
+	while (len > 0) {
+		got = read (fd, tmp, len);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return FALSE;
+		tmp += got;
+		len -= got;
+	}
+	return TRUE;
+}
+
+/**
+ * cra_worker_child_main:
+ *
+ * Runs in the worker process until the coordinator closes the job pipe.
+ */
+static void
+cra_worker_child_main (CraWorkerPool *pool, gint fd_jobs, gint fd_results)
+{
+	CraWorkerHeader hdr;
+	GString *result;
+	guint32 job;
+
+	while (cra_worker_read_all (fd_jobs, &job, sizeof (job))) {
+		result = pool->func (job, pool->user_data);
+		hdr.job = job;
+		hdr.len = result->len;
+		if (!cra_worker_write_all (fd_results, &hdr, sizeof (hdr)) ||
+		    !cra_worker_write_all (fd_results, result->str, result->len))
+			break;
+		g_string_free (result, TRUE);
+		fflush (NULL);
+	}
+	fflush (NULL);
+	_exit (0);
+}
+
+/**
+ * cra_worker_close:
+ */
+static void
+cra_worker_close (CraWorker *worker)
+{
+	if (worker->watch_id != 0) {
+		g_source_remove (worker->watch_id);
+		worker->watch_id = 0;
+	}
+	if (worker->fd_jobs >= 0) {
+		close (worker->fd_jobs);
+		worker->fd_jobs = -1;
+	}
+	if (worker->fd_results >= 0) {
+		close (worker->fd_results);
+		worker->fd_results = -1;
+	}
+}
+
+/**
+ * cra_worker_reap:
+ */
+static void
+cra_worker_reap (CraWorker *worker)
+{
+	gint status = 0;
+
+	cra_worker_close (worker);
+	if (worker->pid <= 0)
+		return;
+	while (waitpid (worker->pid, &status, 0) < 0 && errno == EINTR);
+	if (WIFSIGNALED (status) && !worker->timed_out) {
+		g_warning ("worker %i was killed by signal %i",
+			   worker->pid, WTERMSIG (status));
+	}
+	worker->pid = 0;
+}
+
+/**
+ * cra_worker_dispatch:
+ *
+ * Gives the worker the next job, if there is one and it is admitted.
+ */
+static void
+cra_worker_dispatch (CraWorker *worker)
+{
+	CraWorkerPool *pool = worker->pool;
+	gboolean retry;
+	guint32 job;
+
+	worker->job = -1;
+	retry = !g_queue_is_empty (&pool->retry);
+	if (retry)
+		job = GPOINTER_TO_UINT (g_queue_peek_head (&pool->retry)) - 1;
+	else if (pool->next_job < pool->nr_jobs)
+		job = pool->next_job;
+	else
+		return;
+
+	/* leave the worker idle until another job is done */
+	if (pool->admit_func != NULL &&
+	    !pool->admit_func (job, TRUE, pool->user_data))
+		return;
+	if (retry)
+		g_queue_pop_head (&pool->retry);
+	else
+		pool->next_job++;
+
+	/* the worker has gone away, so let another worker have it */
+	if (!cra_worker_write_all (worker->fd_jobs, &job, sizeof (job))) {
+		if (pool->admit_func != NULL)
+			pool->admit_func (job, FALSE, pool->user_data);
+		g_queue_push_tail (&pool->retry, GUINT_TO_POINTER (job + 1));
+		return;
+	}
+	worker->job = job;
+	worker->job_start = g_get_monotonic_time ();
+}
+
+/**
+ * cra_worker_job_done:
+ */
+static void
+cra_worker_job_done (CraWorkerPool *pool,
+		     guint job,
+		     const gchar *data,
+		     gsize len,
+		     const GError *error)
+{
+	if (pool->admit_func != NULL)
+		pool->admit_func (job, FALSE, pool->user_data);
+	pool->result_func (job, data, len, error, pool->user_data);
+	if (++pool->nr_done == pool->nr_jobs)
+		g_main_loop_quit (pool->loop);
+}
+
+/**
+ * cra_worker_dispatch_idle:
+ *
+ * Gives a job to every idle worker, for instance to pick up any jobs that
+ * could not be sent to a dead worker or that were held back.
+ */
+static void
+cra_worker_dispatch_idle (CraWorkerPool *pool)
+{
+	guint i;
+
+	for (i = 0; i < pool->nr_workers; i++) {
+		if (pool->workers[i].job < 0 && pool->workers[i].pid > 0)
+			cra_worker_dispatch (&pool->workers[i]);
+	}
+}
+
+/**
+ * cra_worker_crashed:
+ *
+ * The job the worker was running is not retried as it is probably what made
+ * the worker crash, but a new worker is started for the remaining jobs.
+ */
+static void
+cra_worker_crashed (CraWorker *worker)
+{
+	CraWorkerPool *pool = worker->pool;
+	gint job = worker->job;
+	_cleanup_error_free_ GError *error = NULL;
+
+	cra_worker_reap (worker);
+	g_byte_array_set_size (worker->buf, 0);
+	if (worker->timed_out) {
+		error = g_error_new (CRA_PLUGIN_ERROR,
+				     CRA_PLUGIN_ERROR_FAILED,
+				     "Worker killed after %us",
+				     pool->timeout);
+	} else {
+		error = g_error_new_literal (CRA_PLUGIN_ERROR,
+					     CRA_PLUGIN_ERROR_FAILED,
+					     "Worker crashed");
+	}
+	if (job >= 0)
+		cra_worker_job_done (pool, job, NULL, 0, error);
+	if (pool->nr_done == pool->nr_jobs)
+		return;
+	if (!cra_worker_spawn (worker, &pool->error)) {
+		g_main_loop_quit (pool->loop);
+		return;
+	}
+
+	cra_worker_dispatch (worker);
+	cra_worker_dispatch_idle (pool);
+}
+
+/**
+ * cra_worker_results_cb:
+ */
+static gboolean
+cra_worker_results_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+	CraWorker *worker = (CraWorker *) user_data;
+	CraWorkerHeader hdr;
+	gssize len;
+	guint8 buf[65536];
+
+	len = read (fd, buf, sizeof (buf));
+	if (len < 0 && errno == EINTR)
+		return G_SOURCE_CONTINUE;
+	if (len <= 0) {
+		worker->watch_id = 0;
+		cra_worker_crashed (worker);
+		return G_SOURCE_REMOVE;
+	}
+	g_byte_array_append (worker->buf, buf, len);
+
+	/* a complete result has arrived */
+	if (worker->buf->len < sizeof (hdr))
+		return G_SOURCE_CONTINUE;
+	memcpy (&hdr, worker->buf->data, sizeof (hdr));
+	if (worker->buf->len < sizeof (hdr) + hdr.len)
+		return G_SOURCE_CONTINUE;
+	cra_worker_job_done (worker->pool,
+			     hdr.job,
+			     (const gchar *) worker->buf->data + sizeof (hdr),
+			     hdr.len,
+			     NULL);
+	g_byte_array_remove_range (worker->buf, 0, sizeof (hdr) + hdr.len);
+	cra_worker_dispatch (worker);
+	if (worker->pool->admit_func != NULL)
+		cra_worker_dispatch_idle (worker->pool);
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * cra_worker_timeout_cb:
+ *
+ * Kills any worker that is still stuck in a job after the deadline. This
+ * is the last resort for code that never checks for cancellation, and the
+ * worker is restarted like it had crashed.
+ */
+static gboolean
+cra_worker_timeout_cb (gpointer user_data)
+{
+	CraWorker *worker;
+	CraWorkerPool *pool = (CraWorkerPool *) user_data;
+	gint64 deadline;
+	guint i;
+
+	deadline = g_get_monotonic_time ();
+	deadline -= (gint64) pool->timeout * G_USEC_PER_SEC;
+	for (i = 0; i < pool->nr_workers; i++) {
+		worker = &pool->workers[i];
+		if (worker->pid <= 0 || worker->job < 0 || worker->timed_out)
+			continue;
+		if (worker->job_start > deadline)
+			continue;
+		g_warning ("killing worker %i as job %i took over %us",
+			   worker->pid, worker->job, pool->timeout);
+		worker->timed_out = TRUE;
+		kill (worker->pid, SIGKILL);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * cra_worker_spawn:
+ */
+static gboolean
+cra_worker_spawn (CraWorker *worker, GError **error)
+{
+	CraWorkerPool *pool = worker->pool;
+	gint fd_jobs[2];
+	gint fd_results[2];
+	guint i;
+	pid_t pid;
+
+	if (pipe (fd_jobs) < 0) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to create pipe: %s",
+			     g_strerror (errno));
+		return FALSE;
+	}
+	if (pipe (fd_results) < 0) {
+		close (fd_jobs[0]);
+		close (fd_jobs[1]);
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to create pipe: %s",
+			     g_strerror (errno));
+		return FALSE;
+	}
+
+	/* do not print anything buffered twice */
+	fflush (NULL);
+	pid = fork ();
+	if (pid < 0) {
+		close (fd_jobs[0]);
+		close (fd_jobs[1]);
+		close (fd_results[0]);
+		close (fd_results[1]);
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to fork: %s",
+			     g_strerror (errno));
+		return FALSE;
+	}
+	if (pid == 0) {
+		/* the other workers only see EOF if we do not hold their pipes */
+		for (i = 0; i < pool->nr_workers; i++) {
+			if (pool->workers[i].fd_jobs >= 0)
+				close (pool->workers[i].fd_jobs);
+			if (pool->workers[i].fd_results >= 0)
+				close (pool->workers[i].fd_results);
+		}
+		close (fd_jobs[1]);
+		close (fd_results[0]);
+		cra_worker_child_main (pool, fd_jobs[0], fd_results[1]);
+	}
+
+	close (fd_jobs[0]);
+	close (fd_results[1]);
+	worker->pid = pid;
+	worker->job = -1;
+	worker->timed_out = FALSE;
+	worker->fd_jobs = fd_jobs[1];
+	worker->fd_results = fd_results[0];
+	worker->watch_id = g_unix_fd_add (worker->fd_results,
+					  G_IO_IN | G_IO_HUP | G_IO_ERR,
+					  cra_worker_results_cb,
+					  worker);
+	return TRUE;
+}
+
+/**
+ * cra_worker_pool_run:
+ *
+ * Runs @func for each job in a pool of forked worker processes, and runs
+ * @result_func in this process for each result in the order they finish.
+ * Each worker only runs one job at a time and is restarted if it crashes.
+ * If @timeout is non-zero, a worker that spends longer than @timeout seconds
+ * on one job is killed. If @admit_func is set, jobs are only sent to workers
+ * once it has admitted them.
+ *
+ * This has to be called before any threads have been started.
+ */
+gboolean
+cra_worker_pool_run (guint nr_workers,
+		     guint nr_jobs,
+		     guint timeout,
+		     CraWorkerFunc func,
+		     CraWorkerResultFunc result_func,
+		     CraWorkerAdmitFunc admit_func,
+		     gpointer user_data,
+		     GError **error)
+{
+	CraWorker *worker;
+	CraWorkerPool pool;
+	gboolean ret = TRUE;
+	guint i;
+	guint timeout_id = 0;
+
+	if (nr_jobs == 0)
+		return TRUE;
+
+	/* we get EPIPE rather than being killed if a worker goes away */
+	signal (SIGPIPE, SIG_IGN);
+
+	memset (&pool, 0, sizeof (pool));
+	pool.nr_workers = MAX (nr_workers, 1);
+	pool.nr_jobs = nr_jobs;
+	pool.timeout = timeout;
+	pool.func = func;
+	pool.result_func = result_func;
+	pool.admit_func = admit_func;
+	pool.user_data = user_data;
+	pool.loop = g_main_loop_new (NULL, FALSE);
+	g_queue_init (&pool.retry);
+	pool.workers = g_new0 (CraWorker, pool.nr_workers);
+	for (i = 0; i < pool.nr_workers; i++) {
+		worker = &pool.workers[i];
+		worker->pool = &pool;
+		worker->fd_jobs = -1;
+		worker->fd_results = -1;
+		worker->job = -1;
+		worker->buf = g_byte_array_new ();
+	}
+	for (i = 0; i < pool.nr_workers; i++) {
+		worker = &pool.workers[i];
+		if (!cra_worker_spawn (worker, error)) {
+			ret = FALSE;
+			goto out;
+		}
+		cra_worker_dispatch (worker);
+	}
+
+	/* wait for all the results */
+	if (timeout > 0)
+		timeout_id = g_timeout_add_seconds (1, cra_worker_timeout_cb, &pool);
+	g_main_loop_run (pool.loop);
+	if (timeout_id != 0)
+		g_source_remove (timeout_id);
+	if (pool.error != NULL) {
+		ret = FALSE;
+		g_propagate_error (error, pool.error);
+	}
+out:
+	/* the workers exit when there are no more jobs */
+	for (i = 0; i < pool.nr_workers; i++)
+		cra_worker_close (&pool.workers[i]);
+	for (i = 0; i < pool.nr_workers; i++) {
+		worker = &pool.workers[i];
+		cra_worker_reap (worker);
+		g_byte_array_unref (worker->buf);
+	}
+	g_free (pool.workers);
+	g_queue_clear (&pool.retry);
+	g_main_loop_unref (pool.loop);
+	return ret;
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRA_WORKER_H
+#define __CRA_WORKER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* called in the worker process, returning the result to send back */
+typedef GString		*(*CraWorkerFunc)		(guint		 idx,
+							 gpointer	 user_data);
+
+/* called in the coordinator, with @data %NULL and @error set if the worker
+ * crashed or was killed for taking too long */
+typedef void		 (*CraWorkerResultFunc)		(guint		 idx,
+							 const gchar	*data,
+							 gsize		 len,
+							 const GError	*error,
+							 gpointer	 user_data);
+
+/* called in the coordinator with @admit set before a job is sent to a worker,
+ * returning %FALSE to hold it back until another job is done, and again with
+ * @admit unset once the job is done or could not be sent */
+typedef gboolean	 (*CraWorkerAdmitFunc)		(guint		 idx,
+							 gboolean	 admit,
+							 gpointer	 user_data);
+
+gboolean	 cra_worker_pool_run			(guint		 nr_workers,
+							 guint		 nr_jobs,
+							 guint		 timeout,
+							 CraWorkerFunc	 func,
+							 CraWorkerResultFunc result_func,
+							 CraWorkerAdmitFunc admit_func,
+							 gpointer	 user_data,
+							 GError		**error);
+
+G_END_DECLS
+
+#endif /* __CRA_WORKER_H */
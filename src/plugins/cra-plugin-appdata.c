@@ -24,6 +24,7 @@
 #include <appstream-glib.h>
 #include <libsoup/soup.h>
 
+#include <cra-metrics.h>
 #include <cra-plugin.h>
 
 struct CraPluginPrivate {
@@ -196,6 +197,23 @@ cra_plugin_appdata_log_overwrite (CraApp *app,
 	}
 }
 
+typedef struct {
+	SoupSession	*session;
+	SoupMessage	*msg;
+} CraPluginAppdataDownload;
+
+/**
+ * cra_plugin_appdata_cancelled_cb:
+ *
+ * Called from the watchdog when the package runs out of time.
+ **/
+static void
+cra_plugin_appdata_cancelled_cb (GCancellable *cancellable, gpointer user_data)
+{
+	CraPluginAppdataDownload *dl = (CraPluginAppdataDownload *) user_data;
+	soup_session_cancel_message (dl->session, dl->msg, SOUP_STATUS_CANCELLED);
+}
+
 /**
  * cra_plugin_appdata_load_url:
  **/
@@ -205,8 +223,11 @@ cra_plugin_appdata_load_url (CraPlugin *plugin,
 			     const gchar *url,
 			     GError **error)
 {
+	CraPluginAppdataDownload dl;
+	GCancellable *cancellable;
 	const gchar *cache_dir;
 	gboolean ret = TRUE;
+	gulong cancel_id;
 	SoupStatus status;
 	SoupURI *uri = NULL;
 	_cleanup_free_ gchar *basename;
@@ -220,7 +241,10 @@ cra_plugin_appdata_load_url (CraPlugin *plugin,
 					  cache_dir,
 					  as_app_get_id (AS_APP (app)),
 					  basename);
-	if (!g_file_test (cache_filename, G_FILE_TEST_EXISTS)) {
+	if (g_file_test (cache_filename, G_FILE_TEST_EXISTS)) {
+		cra_metrics_add (CRA_METRIC_SCREENSHOT_CACHE, "hit", 1);
+	} else {
+		cra_metrics_add (CRA_METRIC_SCREENSHOT_CACHE, "miss", 1);
 		uri = soup_uri_new (url);
 		if (uri == NULL) {
 			ret = FALSE;
@@ -233,8 +257,19 @@ cra_plugin_appdata_load_url (CraPlugin *plugin,
 		cra_package_log (cra_app_get_package (app),
 				 CRA_PACKAGE_LOG_LEVEL_DEBUG,
 				 "Downloading %s", url);
+		cancellable = cra_package_get_cancellable (cra_app_get_package (app));
+		if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+			ret = FALSE;
+			goto out;
+		}
 		msg = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		dl.session = plugin->priv->session;
+		dl.msg = msg;
+		cancel_id = g_cancellable_connect (cancellable,
+						   G_CALLBACK (cra_plugin_appdata_cancelled_cb),
+						   &dl, NULL);
 		status = soup_session_send_message (plugin->priv->session, msg);
+		g_cancellable_disconnect (cancellable, cancel_id);
 		if (status != SOUP_STATUS_OK) {
 			ret = FALSE;
 			g_set_error (error,
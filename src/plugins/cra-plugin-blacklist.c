@@ -157,6 +157,6 @@ cra_plugin_process_app (CraPlugin *plugin,
 	tmp = cra_glob_value_search (plugin->priv->vetos,
 				     as_app_get_id (AS_APP (app)));
 	if (tmp != NULL)
-		cra_app_add_veto (app, "%s", tmp);
+		cra_app_add_veto (app, "blacklisted", "%s", tmp);
 	return TRUE;
 }
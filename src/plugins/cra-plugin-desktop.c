@@ -24,6 +24,7 @@
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include <cra-plugin.h>
+#include <cra-profile.h>
 
 /**
  * cra_plugin_get_name:
@@ -74,13 +75,24 @@ cra_plugin_check_filename (CraPlugin *plugin, const gchar *filename)
  * cra_app_load_icon:
  */
 static GdkPixbuf *
-cra_app_load_icon (const gchar *filename, GError **error)
+cra_app_load_icon (const gchar *filename,
+		   GCancellable *cancellable,
+		   GError **error)
 {
 	GdkPixbuf *pixbuf = NULL;
-	_cleanup_object_unref_ GdkPixbuf *pixbuf_tmp;
+	_cleanup_object_unref_ GdkPixbuf *pixbuf_tmp = NULL;
+	_cleanup_object_unref_ GFile *file = NULL;
+	_cleanup_object_unref_ GFileInputStream *stream = NULL;
+	_cleanup_object_unref_ GFileInputStream *stream_scaled = NULL;
 
-	/* open file in native size */
-	pixbuf_tmp = gdk_pixbuf_new_from_file (filename, error);
+	/* open file in native size, loading from a stream so that a huge
+	 * icon can be abandoned if the package runs out of time */
+	file = g_file_new_for_path (filename);
+	stream = g_file_read (file, cancellable, error);
+	if (stream == NULL)
+		return NULL;
+	pixbuf_tmp = gdk_pixbuf_new_from_stream (G_INPUT_STREAM (stream),
+						 cancellable, error);
 	if (pixbuf_tmp == NULL)
 		return NULL;
 
@@ -98,8 +110,12 @@ cra_app_load_icon (const gchar *filename, GError **error)
 	}
 
 	/* re-open file at correct size */
-	pixbuf = gdk_pixbuf_new_from_file_at_scale (filename, 64, 64,
-						    FALSE, error);
+	stream_scaled = g_file_read (file, cancellable, error);
+	if (stream_scaled == NULL)
+		return NULL;
+	pixbuf = gdk_pixbuf_new_from_stream_at_scale (G_INPUT_STREAM (stream_scaled),
+						      64, 64, FALSE,
+						      cancellable, error);
 	if (pixbuf == NULL) {
 		g_prefix_error (error, "Failed to open icon %s: ", filename);
 		return NULL;
@@ -111,7 +127,10 @@ cra_app_load_icon (const gchar *filename, GError **error)
  * cra_app_find_icon:
  */
 static GdkPixbuf *
-cra_app_find_icon (const gchar *tmpdir, const gchar *something, GError **error)
+cra_app_find_icon (const gchar *tmpdir,
+		   const gchar *something,
+		   GCancellable *cancellable,
+		   GError **error)
 {
 	guint i;
 	guint j;
@@ -145,7 +164,7 @@ cra_app_find_icon (const gchar *tmpdir, const gchar *something, GError **error)
 				     something);
 			return NULL;
 		}
-		return cra_app_load_icon (tmp, error);
+		return cra_app_load_icon (tmp, cancellable, error);
 	}
 
 	/* hicolor apps */
@@ -158,7 +177,7 @@ cra_app_find_icon (const gchar *tmpdir, const gchar *something, GError **error)
 					       something,
 					       supported_ext[j]);
 			if (g_file_test (tmp, G_FILE_TEST_EXISTS))
-				return cra_app_load_icon (tmp, error);
+				return cra_app_load_icon (tmp, cancellable, error);
 		}
 	}
 
@@ -172,7 +191,7 @@ cra_app_find_icon (const gchar *tmpdir, const gchar *something, GError **error)
 					       something,
 					       supported_ext[j]);
 			if (g_file_test (tmp, G_FILE_TEST_EXISTS))
-				return cra_app_load_icon (tmp, error);
+				return cra_app_load_icon (tmp, cancellable, error);
 		}
 	}
 
@@ -197,6 +216,7 @@ cra_plugin_process_filename (CraPlugin *plugin,
 {
 	const gchar *key;
 	gboolean ret;
+	gint64 profile;
 	_cleanup_free_ gchar *app_id = NULL;
 	_cleanup_free_ gchar *full_filename = NULL;
 	_cleanup_free_ gchar *icon_filename = NULL;
@@ -235,14 +255,21 @@ cra_plugin_process_filename (CraPlugin *plugin,
 
 			/* is icon XPM or GIF */
 			if (g_str_has_suffix (key, ".xpm"))
-				cra_app_add_veto (app, "Uses XPM icon: %s", key);
+				cra_app_add_veto (app, "xpm-icon",
+						  "Uses XPM icon: %s", key);
 			else if (g_str_has_suffix (key, ".gif"))
-				cra_app_add_veto (app, "Uses GIF icon: %s", key);
+				cra_app_add_veto (app, "gif-icon",
+						  "Uses GIF icon: %s", key);
 			else if (g_str_has_suffix (key, ".ico"))
-				cra_app_add_veto (app, "Uses ICO icon: %s", key);
+				cra_app_add_veto (app, "ico-icon",
+						  "Uses ICO icon: %s", key);
 
 			/* find icon */
-			pixbuf = cra_app_find_icon (tmpdir, key, error);
+			profile = cra_profile_start ();
+			pixbuf = cra_app_find_icon (tmpdir, key,
+						    cra_package_get_cancellable (pkg),
+						    error);
+			cra_profile_stop (profile, pkg, "icon-load", NULL);
 			if (pixbuf == NULL)
 				return FALSE;
 
@@ -260,6 +287,38 @@ cra_plugin_process_filename (CraPlugin *plugin,
 	return TRUE;
 }
 
+/**
+ * cra_plugin_process_file:
+ */
+gboolean
+cra_plugin_process_file (CraPlugin *plugin,
+			 CraPackage *pkg,
+			 const gchar *filename,
+			 GList **apps,
+			 const gchar *tmpdir,
+			 GError **error)
+{
+	gboolean ret;
+	GError *error_local = NULL;
+
+	/* a bad desktop file does not fail the other applications */
+	ret = cra_plugin_process_filename (plugin,
+					   pkg,
+					   filename,
+					   apps,
+					   tmpdir,
+					   &error_local);
+	if (!ret) {
+		cra_package_log (pkg,
+				 CRA_PACKAGE_LOG_LEVEL_INFO,
+				 "Failed to process %s: %s",
+				 filename,
+				 error_local->message);
+		g_error_free (error_local);
+	}
+	return TRUE;
+}
+
 /**
  * cra_plugin_process:
  */
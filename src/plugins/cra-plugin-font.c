@@ -26,15 +26,48 @@
 #include <cairo/cairo.h>
 #include <cairo/cairo-ft.h>
 #include <ft2build.h>
-#include FT_SFNT_NAMES_H
-#include FT_TRUETYPE_IDS_H
 #include FT_MODULE_H
 #include <pango/pango.h>
 #include <pango/pangofc-fontmap.h>
 #include <fontconfig/fontconfig.h>
 
+#include <cra-pixels.h>
 #include <cra-plugin.h>
 
+/* each worker thread reuses its own, as it is not thread safe */
+typedef struct {
+	FT_Library	 library;
+	GMutex		 mutex;			/* for ->library */
+	gint		 refcount;
+} CraFontContext;
+
+typedef struct {
+	CraFontContext	*ctx;
+	FT_Face		 face;
+	GMappedFile	*mapped;		/* the face reads from this */
+} CraFontFace;
+
+/* the font being processed, only opened in cairo if it has to be drawn */
+typedef struct {
+	CraPlugin		*plugin;
+	GMappedFile		*mapped;
+	const guint8		*data;
+	gsize			 len;
+	cairo_font_face_t	*font_face;
+	gchar			*digest;
+} CraFontFile;
+
+/* bump this when the previews would look different */
+#define CRA_FONT_RENDER_VERSION		1
+
+struct CraPluginPrivate {
+	GPtrArray	*contexts;
+	GMutex		 contexts_mutex;	/* for ->contexts */
+};
+
+static GPrivate cra_font_context_private = G_PRIVATE_INIT (NULL);
+static const cairo_user_data_key_t cra_font_face_key;
+
 /**
  * cra_plugin_get_name:
  */
@@ -44,6 +77,532 @@ cra_plugin_get_name (void)
 	return "font";
 }
 
+/**
+ * cra_font_context_unref:
+ */
+static void
+cra_font_context_unref (CraFontContext *ctx)
+{
+	if (!g_atomic_int_dec_and_test (&ctx->refcount))
+		return;
+	FT_Done_FreeType (ctx->library);
+	g_mutex_clear (&ctx->mutex);
+	g_free (ctx);
+}
+
+/**
+ * cra_font_context_get:
+ *
+ * Returns the context for this thread, which is kept until the plugin is
+ * destroyed.
+ */
+static CraFontContext *
+cra_font_context_get (CraPlugin *plugin, GError **error)
+{
+	CraFontContext *ctx;
+	FT_Error rc;
+
+	ctx = g_private_get (&cra_font_context_private);
+	if (ctx != NULL)
+		return ctx;
+	ctx = g_new0 (CraFontContext, 1);
+	rc = FT_Init_FreeType (&ctx->library);
+	if (rc != 0) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "FT_Init_FreeType failed: %i", rc);
+		g_free (ctx);
+		return NULL;
+	}
+	ctx->refcount = 1;
+	g_mutex_init (&ctx->mutex);
+	g_private_set (&cra_font_context_private, ctx);
+	g_mutex_lock (&plugin->priv->contexts_mutex);
+	g_ptr_array_add (plugin->priv->contexts, ctx);
+	g_mutex_unlock (&plugin->priv->contexts_mutex);
+	return ctx;
+}
+
+/**
+ * cra_font_face_free:
+ *
+ * Called when cairo drops the font face, which may be from another thread
+ * if it was kept in the font cache.
+ */
+static void
+cra_font_face_free (CraFontFace *face)
+{
+	g_mutex_lock (&face->ctx->mutex);
+	FT_Done_Face (face->face);
+	g_mutex_unlock (&face->ctx->mutex);
+	cra_font_context_unref (face->ctx);
+	g_mapped_file_unref (face->mapped);
+	g_free (face);
+}
+
+/**
+ * cra_font_face_new:
+ *
+ * Returns a cairo font face that closes @ft_face when it is destroyed.
+ */
+static cairo_font_face_t *
+cra_font_face_new (CraFontContext *ctx, FT_Face ft_face, GMappedFile *mapped)
+{
+	CraFontFace *face;
+	cairo_font_face_t *font_face;
+	cairo_status_t status;
+
+	face = g_new0 (CraFontFace, 1);
+	face->ctx = ctx;
+	face->face = ft_face;
+	face->mapped = g_mapped_file_ref (mapped);
+	g_atomic_int_inc (&ctx->refcount);
+	font_face = cairo_ft_font_face_create_for_ft_face (ft_face, FT_LOAD_DEFAULT);
+	status = cairo_font_face_set_user_data (font_face,
+						&cra_font_face_key,
+						face,
+						(cairo_destroy_func_t) cra_font_face_free);
+	if (status != CAIRO_STATUS_SUCCESS) {
+		cairo_font_face_destroy (font_face);
+		cra_font_face_free (face);
+		return NULL;
+	}
+	return font_face;
+}
+
+/**
+ * cra_font_file_get_font_face:
+ *
+ * Opens the font in FreeType, which is only done when it has to be drawn.
+ */
+static cairo_font_face_t *
+cra_font_file_get_font_face (CraFontFile *file, GError **error)
+{
+	CraFontContext *ctx;
+	FT_Error rc;
+	FT_Face ft_face;
+
+	if (file->font_face != NULL)
+		return file->font_face;
+
+	ctx = cra_font_context_get (file->plugin, error);
+	if (ctx == NULL)
+		return NULL;
+	g_mutex_lock (&ctx->mutex);
+	rc = FT_New_Memory_Face (ctx->library, file->data, file->len, 0, &ft_face);
+	g_mutex_unlock (&ctx->mutex);
+	if (rc != 0) {
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "FT_New_Memory_Face failed: %i", rc);
+		return NULL;
+	}
+
+	/* this now owns the FT_Face */
+	file->font_face = cra_font_face_new (ctx, ft_face, file->mapped);
+	if (file->font_face == NULL) {
+		g_set_error_literal (error,
+				     CRA_PLUGIN_ERROR,
+				     CRA_PLUGIN_ERROR_FAILED,
+				     "Failed to create cairo font face");
+		return NULL;
+	}
+	return file->font_face;
+}
+
+/**
+ * cra_font_file_clear:
+ */
+static void
+cra_font_file_clear (CraFontFile *file)
+{
+	if (file->font_face != NULL)
+		cairo_font_face_destroy (file->font_face);
+	if (file->mapped != NULL)
+		g_mapped_file_unref (file->mapped);
+	g_free (file->digest);
+}
+
+/**
+ * cra_sfnt_read16:
+ */
+static guint16
+cra_sfnt_read16 (const guint8 *data)
+{
+	return (guint16) (data[0] << 8 | data[1]);
+}
+
+/**
+ * cra_sfnt_read32:
+ */
+static guint32
+cra_sfnt_read32 (const guint8 *data)
+{
+	return (guint32) data[0] << 24 | (guint32) data[1] << 16 |
+	       (guint32) data[2] << 8 | (guint32) data[3];
+}
+
+/**
+ * cra_sfnt_get_table:
+ *
+ * Finds @tag in the table directory of the font, or of the first font in a
+ * collection, which is also the face FreeType opens.
+ */
+static gboolean
+cra_sfnt_get_table (const guint8 *data,
+		    gsize len,
+		    const gchar *tag,
+		    const guint8 **table,
+		    gsize *table_len)
+{
+	const guint8 *rec;
+	gsize offset = 0;
+	guint32 table_offset;
+	guint32 table_size;
+	guint i;
+	guint nr_tables;
+
+	if (len < 12)
+		return FALSE;
+	if (memcmp (data, "ttcf", 4) == 0) {
+		if (len < 16)
+			return FALSE;
+		offset = cra_sfnt_read32 (data + 12);
+		if (offset > len - 12)
+			return FALSE;
+	}
+	nr_tables = cra_sfnt_read16 (data + offset + 4);
+	for (i = 0; i < nr_tables; i++) {
+		if (offset + 12 + (i + 1) * 16 > len)
+			return FALSE;
+		rec = data + offset + 12 + i * 16;
+		if (memcmp (rec, tag, 4) != 0)
+			continue;
+		table_offset = cra_sfnt_read32 (rec + 8);
+		table_size = cra_sfnt_read32 (rec + 12);
+		if (table_offset > len || table_size > len - table_offset)
+			return FALSE;
+		*table = data + table_offset;
+		*table_len = table_size;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * cra_sfnt_get_name:
+ *
+ * Returns the name with @name_id as UTF-8, preferring US English and then
+ * any Unicode record, or %NULL if the font does not have one.
+ */
+static gchar *
+cra_sfnt_get_name (const guint8 *table, gsize len, guint16 name_id)
+{
+	const guint8 *rec;
+	const guint8 *best = NULL;
+	guint16 encoding;
+	guint16 language;
+	guint16 platform;
+	guint best_score = 0;
+	guint i;
+	guint nr_names;
+	guint score;
+	gsize offset;
+	gsize size;
+
+	if (len < 6)
+		return NULL;
+	nr_names = cra_sfnt_read16 (table + 2);
+	for (i = 0; i < nr_names; i++) {
+		if (6 + (i + 1) * 12 > len)
+			break;
+		rec = table + 6 + i * 12;
+		if (cra_sfnt_read16 (rec + 6) != name_id)
+			continue;
+		platform = cra_sfnt_read16 (rec);
+		encoding = cra_sfnt_read16 (rec + 2);
+		language = cra_sfnt_read16 (rec + 4);
+		if (platform == 3 && language == 0x409)
+			score = 4;
+		else if (platform == 1 && encoding == 0 && language == 0)
+			score = 3;
+		else if (platform == 0)
+			score = 2;
+		else if (platform == 3)
+			score = 1;
+		else
+			continue;
+		if (score > best_score) {
+			best = rec;
+			best_score = score;
+		}
+	}
+	if (best == NULL)
+		return NULL;
+
+	/* Mac Roman names are single byte, the others are UTF-16 */
+	offset = cra_sfnt_read16 (table + 4) + cra_sfnt_read16 (best + 10);
+	size = cra_sfnt_read16 (best + 8);
+	if (offset > len || size > len - offset)
+		return NULL;
+	return g_convert ((const gchar *) table + offset, size, "UTF-8",
+			  cra_sfnt_read16 (best) == 1 ? "MACINTOSH" : "UTF-16BE",
+			  NULL, NULL, NULL);
+}
+
+/**
+ * cra_sfnt_get_first_name:
+ */
+static gchar *
+cra_sfnt_get_first_name (const guint8 *table, gsize len, const guint16 *name_ids)
+{
+	gchar *tmp;
+	guint i;
+
+	for (i = 0; name_ids[i] != 0; i++) {
+		tmp = cra_sfnt_get_name (table, len, name_ids[i]);
+		if (tmp != NULL)
+			return tmp;
+	}
+	return NULL;
+}
+
+/**
+ * cra_sfnt_has_wws_names:
+ *
+ * Returns %TRUE if the family and style names already follow the
+ * weight/width/slope model, in which case FreeType uses them.
+ */
+static gboolean
+cra_sfnt_has_wws_names (const guint8 *data, gsize len)
+{
+	const guint8 *os2;
+	gsize os2_len;
+
+	if (!cra_sfnt_get_table (data, len, "OS/2", &os2, &os2_len))
+		return FALSE;
+	if (os2_len < 64)
+		return FALSE;
+	return (cra_sfnt_read16 (os2 + 62) & 0x100) > 0;
+}
+
+/* more than this is not Unicode, so the cmap is broken */
+#define CRA_SFNT_MAX_CODEPOINTS		0x110000
+
+/**
+ * cra_sfnt_check_total:
+ */
+static gboolean
+cra_sfnt_check_total (guint *total, GError **error)
+{
+	if ((*total)++ < CRA_SFNT_MAX_CODEPOINTS)
+		return TRUE;
+	g_set_error (error,
+		     CRA_PLUGIN_ERROR,
+		     CRA_PLUGIN_ERROR_FAILED,
+		     "cmap has more than %u codepoints",
+		     CRA_SFNT_MAX_CODEPOINTS);
+	return FALSE;
+}
+
+/**
+ * cra_sfnt_add_cmap_4:
+ */
+static gboolean
+cra_sfnt_add_cmap_4 (FcCharSet *charset,
+		     const guint8 *sub,
+		     gsize len,
+		     GCancellable *cancellable,
+		     GError **error)
+{
+	const guint8 *range;
+	guint16 end;
+	guint16 glyph;
+	guint16 range_offset;
+	guint16 start;
+	guint32 c;
+	gsize glyph_offset;
+	guint i;
+	guint nr_segs;
+	guint total = 0;
+
+	if (len < 16)
+		return TRUE;
+	len = MIN (len, cra_sfnt_read16 (sub + 2));
+	if (len < 16)
+		return TRUE;
+	nr_segs = cra_sfnt_read16 (sub + 6) / 2;
+	if (16 + nr_segs * 8 > len)
+		return TRUE;
+	for (i = 0; i < nr_segs; i++) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+		end = cra_sfnt_read16 (sub + 14 + i * 2);
+		start = cra_sfnt_read16 (sub + 16 + nr_segs * 2 + i * 2);
+		range = sub + 16 + nr_segs * 6 + i * 2;
+		range_offset = cra_sfnt_read16 (range);
+		for (c = start; c <= end && c != 0xffff; c++) {
+			if (!cra_sfnt_check_total (&total, error))
+				return FALSE;
+			if (range_offset == 0) {
+				glyph = c + cra_sfnt_read16 (sub + 16 + nr_segs * 4 + i * 2);
+			} else {
+				glyph_offset = (range - sub) + range_offset + (c - start) * 2;
+				if (glyph_offset + 2 > len)
+					break;
+				glyph = cra_sfnt_read16 (sub + glyph_offset);
+			}
+			if (glyph != 0)
+				FcCharSetAddChar (charset, c);
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * cra_sfnt_add_cmap_12:
+ */
+static gboolean
+cra_sfnt_add_cmap_12 (FcCharSet *charset,
+		      const guint8 *sub,
+		      gsize len,
+		      GCancellable *cancellable,
+		      GError **error)
+{
+	const guint8 *group;
+	guint32 c;
+	guint32 end;
+	guint32 glyph;
+	guint32 start;
+	guint i;
+	guint nr_groups;
+	guint total = 0;
+
+	if (len < 16)
+		return TRUE;
+	len = MIN (len, cra_sfnt_read32 (sub + 4));
+	if (len < 16)
+		return TRUE;
+	nr_groups = cra_sfnt_read32 (sub + 12);
+	nr_groups = MIN (nr_groups, (len - 16) / 12);
+	for (i = 0; i < nr_groups; i++) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+		group = sub + 16 + i * 12;
+		start = cra_sfnt_read32 (group);
+		end = MIN (cra_sfnt_read32 (group + 4), 0x10ffff);
+		glyph = cra_sfnt_read32 (group + 8);
+		if (start > end)
+			continue;
+		for (c = start; c <= end; c++) {
+			if (!cra_sfnt_check_total (&total, error))
+				return FALSE;
+			if (glyph + (c - start) != 0)
+				FcCharSetAddChar (charset, c);
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * cra_sfnt_get_charset:
+ *
+ * Gets the characters the font has glyphs for, using the best Unicode
+ * subtable in the cmap, or %NULL if there is not one.
+ */
+static gboolean
+cra_sfnt_get_charset (const guint8 *data,
+		      gsize len,
+		      FcCharSet **charset_out,
+		      GCancellable *cancellable,
+		      GError **error)
+{
+	const guint8 *best = NULL;
+	const guint8 *cmap;
+	gboolean ret;
+	gsize best_len = 0;
+	gsize cmap_len;
+	guint16 encoding;
+	guint16 format;
+	guint16 platform;
+	guint32 offset;
+	guint best_score = 0;
+	guint i;
+	guint nr_subtables;
+	guint score;
+	FcCharSet *charset;
+
+	*charset_out = NULL;
+	if (!cra_sfnt_get_table (data, len, "cmap", &cmap, &cmap_len))
+		return TRUE;
+	if (cmap_len < 4)
+		return TRUE;
+	nr_subtables = cra_sfnt_read16 (cmap + 2);
+	for (i = 0; i < nr_subtables; i++) {
+		if (4 + (i + 1) * 8 > cmap_len)
+			break;
+		platform = cra_sfnt_read16 (cmap + 4 + i * 8);
+		encoding = cra_sfnt_read16 (cmap + 6 + i * 8);
+		offset = cra_sfnt_read32 (cmap + 8 + i * 8);
+		if (offset > cmap_len - 2)
+			continue;
+		format = cra_sfnt_read16 (cmap + offset);
+		if (format == 12 && (platform == 0 || (platform == 3 && encoding == 10)))
+			score = 3;
+		else if (format == 4 && (platform == 0 || (platform == 3 && encoding == 1)))
+			score = 2;
+		else if (format == 4 && platform == 3 && encoding == 0)
+			score = 1;
+		else
+			continue;
+		if (score > best_score) {
+			best = cmap + offset;
+			best_len = cmap_len - offset;
+			best_score = score;
+		}
+	}
+	if (best == NULL)
+		return TRUE;
+
+	charset = FcCharSetCreate ();
+	if (best_score == 3)
+		ret = cra_sfnt_add_cmap_12 (charset, best, best_len,
+					    cancellable, error);
+	else
+		ret = cra_sfnt_add_cmap_4 (charset, best, best_len,
+					   cancellable, error);
+	if (!ret) {
+		FcCharSetDestroy (charset);
+		return FALSE;
+	}
+	*charset_out = charset;
+	return TRUE;
+}
+
+/**
+ * cra_plugin_initialize:
+ */
+void
+cra_plugin_initialize (CraPlugin *plugin)
+{
+	plugin->priv = CRA_PLUGIN_GET_PRIVATE (CraPluginPrivate);
+	plugin->priv->contexts = g_ptr_array_new_with_free_func ((GDestroyNotify) cra_font_context_unref);
+	g_mutex_init (&plugin->priv->contexts_mutex);
+}
+
+/**
+ * cra_plugin_destroy:
+ */
+void
+cra_plugin_destroy (CraPlugin *plugin)
+{
+	g_ptr_array_unref (plugin->priv->contexts);
+	g_mutex_clear (&plugin->priv->contexts_mutex);
+	g_free (plugin->priv);
+}
+
 /**
  * cra_plugin_add_globs:
  */
@@ -235,48 +794,34 @@ cra_font_string_is_valid (const gchar *text)
  * cra_font_add_metadata:
  */
 static void
-cra_font_add_metadata (CraApp *app, FT_Face ft_face)
+cra_font_add_metadata (CraApp *app, const guint8 *table, gsize len)
 {
-	FT_SfntName sfname;
-	guint i;
 	guint j;
-	guint len;
 	struct {
-		FT_UShort	 idx;
+		guint16		 idx;
 		const gchar	*key;
 	} tt_idx_to_md_name[] =  {
-		{ TT_NAME_ID_FONT_FAMILY,		"FontFamily" },
-		{ TT_NAME_ID_FONT_SUBFAMILY,		"FontSubFamily" },
-		{ TT_NAME_ID_FULL_NAME,			"FontFullName" },
-		{ TT_NAME_ID_PREFERRED_FAMILY,		"FontParent" },
+		{ 1,		"FontFamily" },
+		{ 2,		"FontSubFamily" },
+		{ 4,		"FontFullName" },
+		{ 16,		"FontParent" },
 		{ 0, NULL } };
 
-	if (!FT_IS_SFNT (ft_face))
-		return;
-
 	/* look at the metadata table */
-	len = FT_Get_Sfnt_Name_Count (ft_face);
-	for (i = 0; i < len; i++) {
-		FT_Get_Sfnt_Name (ft_face, i, &sfname);
-		for (j = 0; tt_idx_to_md_name[j].key != NULL; j++) {
-			_cleanup_free_ gchar *val = NULL;
-			if (sfname.name_id != tt_idx_to_md_name[j].idx)
-				continue;
-			val = g_locale_to_utf8 ((gchar *) sfname.string,
-						sfname.string_len,
-						NULL, NULL, NULL);
-			if (val == NULL)
-				continue;
-			if (cra_font_string_is_valid (val)) {
-				as_app_add_metadata (AS_APP (app),
-						     tt_idx_to_md_name[j].key,
-						     val, -1);
-			} else {
-				cra_package_log (cra_app_get_package (app),
-						 CRA_PACKAGE_LOG_LEVEL_WARNING,
-						 "Ignoring %s value: '%s'",
-						 tt_idx_to_md_name[j].key, val);
-			}
+	for (j = 0; tt_idx_to_md_name[j].key != NULL; j++) {
+		_cleanup_free_ gchar *val = NULL;
+		val = cra_sfnt_get_name (table, len, tt_idx_to_md_name[j].idx);
+		if (val == NULL)
+			continue;
+		if (cra_font_string_is_valid (val)) {
+			as_app_add_metadata (AS_APP (app),
+					     tt_idx_to_md_name[j].key,
+					     val, -1);
+		} else {
+			cra_package_log (cra_app_get_package (app),
+					 CRA_PACKAGE_LOG_LEVEL_WARNING,
+					 "Ignoring %s value: '%s'",
+					 tt_idx_to_md_name[j].key, val);
 		}
 	}
 }
@@ -287,27 +832,91 @@ cra_font_add_metadata (CraApp *app, FT_Face ft_face)
 static gboolean
 cra_font_is_pixbuf_empty (const GdkPixbuf *pixbuf)
 {
-	gint i, j;
-	gint rowstride;
-	gint width;
-	guchar *pixels;
-	guchar *tmp;
-	guint length;
-	guint cnt = 0;
-
-	pixels = gdk_pixbuf_get_pixels_with_length (pixbuf, &length);
-	width = gdk_pixbuf_get_width (pixbuf);
-	rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-	for (j = 0; j < gdk_pixbuf_get_height (pixbuf); j++) {
-		for (i = 0; i < width; i++) {
-			/* any opacity */
-			tmp = pixels + j * rowstride + i * 4;
-			if (tmp[3] > 0)
-				cnt++;
+	return cra_pixels_count_alpha (pixbuf, 5) <= 5;
+}
+
+/**
+ * cra_font_text_fits:
+ *
+ * Measures @text at @text_size, returning %TRUE if it is not empty and fits
+ * inside the border.
+ */
+static gboolean
+cra_font_text_fits (cairo_t *cr,
+		    const gchar *text,
+		    guint text_size,
+		    gdouble width,
+		    gdouble height,
+		    cairo_text_extents_t *te)
+{
+	cairo_set_font_size (cr, text_size);
+	cairo_text_extents (cr, text, te);
+	if (te->width <= 0.01f || te->height <= 0.01f)
+		return FALSE;
+	return te->width < width && te->height < height;
+}
+
+/* hinting can make a size not fit when a slightly bigger one does */
+#define CRA_FONT_SIZE_SLACK		3
+
+/**
+ * cra_font_get_text_size:
+ *
+ * Finds the largest size below @max_size that @text fits at. The text is
+ * measured at the largest size and that is scaled to fit, then the size is
+ * walked down until it fits and up while any of the next few sizes do,
+ * which is a few layouts rather than one for each size.
+ */
+static gboolean
+cra_font_get_text_size (cairo_t *cr,
+			const gchar *text,
+			guint max_size,
+			gdouble width,
+			gdouble height,
+			cairo_text_extents_t *te,
+			GCancellable *cancellable,
+			GError **error)
+{
+	cairo_text_extents_t te_tmp;
+	gdouble scale;
+	guint next;
+	guint size;
+
+	/* the biggest size fits, or nothing will */
+	size = max_size - 1;
+	if (cra_font_text_fits (cr, text, size, width, height, te))
+		goto out;
+	if (te->width <= 0.01f || te->height <= 0.01f) {
+		size = 0;
+		cra_font_text_fits (cr, text, size, width, height, te);
+		goto out;
+	}
+
+	/* text scales with the size, give or take the hinting */
+	scale = MIN (width / te->width, height / te->height);
+	size = CLAMP ((guint) (size * scale), 1, max_size - 2);
+	while (!cra_font_text_fits (cr, text, size, width, height, te)) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+		if (--size == 0) {
+			cra_font_text_fits (cr, text, size, width, height, te);
+			break;
 		}
 	}
-	if (cnt > 5)
-		return FALSE;
+
+	/* anything bigger that fits, even past a size that does not */
+	for (next = size + 1;
+	     next < max_size - 1 && next <= size + CRA_FONT_SIZE_SLACK;
+	     next++) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+		if (!cra_font_text_fits (cr, text, next, width, height, &te_tmp))
+			continue;
+		size = next;
+		*te = te_tmp;
+	}
+out:
+	cairo_set_font_size (cr, size);
 	return TRUE;
 }
 
@@ -315,37 +924,32 @@ cra_font_is_pixbuf_empty (const GdkPixbuf *pixbuf)
  * cra_font_get_pixbuf:
  */
 static GdkPixbuf *
-cra_font_get_pixbuf (FT_Face ft_face,
+cra_font_get_pixbuf (cairo_font_face_t *font_face,
 		     guint width,
 		     guint height,
 		     const gchar *text,
+		     GCancellable *cancellable,
 		     GError **error)
 {
-	cairo_font_face_t *font_face;
 	cairo_surface_t *surface;
 	cairo_t *cr;
 	cairo_text_extents_t te;
-	GdkPixbuf *pixbuf;
-	guint text_size = 64;
+	GdkPixbuf *pixbuf = NULL;
 	guint border_width = 8;
 
 	/* set up font */
 	surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
 					      width, height);
 	cr = cairo_create (surface);
-	font_face = cairo_ft_font_face_create_for_ft_face (ft_face, FT_LOAD_DEFAULT);
 	cairo_set_font_face (cr, font_face);
 
 	/* calculate best font size */
-	while (text_size-- > 0) {
-		cairo_set_font_size (cr, text_size);
-		cairo_text_extents (cr, text, &te);
-		if (te.width <= 0.01f || te.height <= 0.01f)
-			continue;
-		if (te.width < width - (border_width * 2) &&
-		    te.height < height - (border_width * 2))
-			break;
-	}
+	if (!cra_font_get_text_size (cr, text, 64,
+				     width - (border_width * 2),
+				     height - (border_width * 2),
+				     &te,
+				     cancellable, error))
+		goto out;
 
 	/* center text and blit to a pixbuf */
 	cairo_move_to (cr,
@@ -354,13 +958,117 @@ cra_font_get_pixbuf (FT_Face ft_face,
 	cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
 	cairo_show_text (cr, text);
 	pixbuf = gdk_pixbuf_get_from_surface (surface, 0, 0, width, height);
-
+out:
 	cairo_destroy (cr);
-	cairo_font_face_destroy (font_face);
 	cairo_surface_destroy (surface);
 	return pixbuf;
 }
 
+/**
+ * cra_font_get_cache_filename:
+ *
+ * The rendered previews are cached using the contents of the font file, so
+ * a changed font with the same filename is drawn again. A new cairo or
+ * FreeType may rasterize differently, so their versions are included too.
+ */
+static gchar *
+cra_font_get_cache_filename (CraFontFile *file,
+			     CraApp *app,
+			     guint width,
+			     guint height,
+			     const gchar *text,
+			     GError **error)
+{
+	CraFontContext *ctx;
+	const gchar *cache_dir;
+	FT_Int ft_major;
+	FT_Int ft_minor;
+	FT_Int ft_patch;
+	_cleanup_free_ gchar *key = NULL;
+	_cleanup_free_ gchar *hash = NULL;
+
+	ctx = cra_font_context_get (file->plugin, error);
+	if (ctx == NULL)
+		return NULL;
+	g_mutex_lock (&ctx->mutex);
+	FT_Library_Version (ctx->library, &ft_major, &ft_minor, &ft_patch);
+	g_mutex_unlock (&ctx->mutex);
+	key = g_strdup_printf ("%s\n%s\n%ux%u\n%i\n%s\n%i.%i.%i",
+			       file->digest, text, width, height,
+			       CRA_FONT_RENDER_VERSION,
+			       cairo_version_string (),
+			       ft_major, ft_minor, ft_patch);
+	hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, key, -1);
+	cache_dir = cra_package_get_config (cra_app_get_package (app), "CacheDir");
+	return g_strdup_printf ("%s/font-%s.png", cache_dir, hash);
+}
+
+/**
+ * cra_font_get_pixbuf_cached:
+ */
+static GdkPixbuf *
+cra_font_get_pixbuf_cached (CraFontFile *file,
+			    CraApp *app,
+			    guint width,
+			    guint height,
+			    const gchar *text,
+			    GError **error)
+{
+	CraPackage *pkg = cra_app_get_package (app);
+	cairo_font_face_t *font_face;
+	gchar *data = NULL;
+	gsize len;
+	GdkPixbuf *pixbuf;
+	gboolean ret;
+	_cleanup_error_free_ GError *error_local = NULL;
+	_cleanup_free_ gchar *cache_fn = NULL;
+
+	/* is in the cache */
+	cache_fn = cra_font_get_cache_filename (file, app, width, height,
+						text, error);
+	if (cache_fn == NULL)
+		return NULL;
+	if (g_file_test (cache_fn, G_FILE_TEST_EXISTS)) {
+		pixbuf = gdk_pixbuf_new_from_file (cache_fn, &error_local);
+		if (pixbuf != NULL)
+			return pixbuf;
+		cra_package_log (pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "Ignoring cached preview: %s",
+				 error_local->message);
+		g_clear_error (&error_local);
+	}
+
+	/* draw it */
+	font_face = cra_font_file_get_font_face (file, error);
+	if (font_face == NULL)
+		return NULL;
+	pixbuf = cra_font_get_pixbuf (font_face, width, height, text,
+				      cra_package_get_cancellable (pkg),
+				      error);
+	if (pixbuf == NULL)
+		return NULL;
+
+	/* blank previews are an error, so are not worth saving */
+	if (cra_font_is_pixbuf_empty (pixbuf))
+		return pixbuf;
+
+	/* written to a temp file and renamed, so other workers either see
+	 * all of it or nothing; the preview is still fine if this fails */
+	ret = gdk_pixbuf_save_to_buffer (pixbuf, &data, &len, "png",
+					 &error_local, NULL);
+	if (ret)
+		ret = g_file_set_contents (cache_fn, data, len, &error_local);
+	g_free (data);
+	if (!ret) {
+		cra_package_log (pkg,
+				 CRA_PACKAGE_LOG_LEVEL_WARNING,
+				 "Failed to cache preview: %s",
+				 error_local->message);
+	}
+	return pixbuf;
+}
+
 /**
  * cra_font_get_caption:
  */
@@ -385,13 +1093,11 @@ cra_font_get_caption (CraApp *app)
  * cra_font_add_screenshot:
  */
 static gboolean
-cra_font_add_screenshot (CraApp *app, FT_Face ft_face, GError **error)
+cra_font_add_screenshot (CraApp *app, CraFontFile *file, GError **error)
 {
-	const gchar *cache_dir;
 	const gchar *mirror_uri;
 	const gchar *tmp;
 	_cleanup_free_ gchar *basename = NULL;
-	_cleanup_free_ gchar *cache_fn = NULL;
 	_cleanup_free_ gchar *caption = NULL;
 	_cleanup_free_ gchar *url_tmp = NULL;
 	_cleanup_object_unref_ AsImage *im = NULL;
@@ -402,20 +1108,9 @@ cra_font_add_screenshot (CraApp *app, FT_Face ft_face, GError **error)
 	if (tmp == NULL)
 		return TRUE;
 
-	/* is in the cache */
-	cache_dir = cra_package_get_config (cra_app_get_package (app), "CacheDir");
-	cache_fn = g_strdup_printf ("%s/%s.png",
-				    cache_dir,
-				    as_app_get_id (AS_APP (app)));
-	if (g_file_test (cache_fn, G_FILE_TEST_EXISTS)) {
-		pixbuf = gdk_pixbuf_new_from_file (cache_fn, error);
-		if (pixbuf == NULL)
-			return FALSE;
-	} else {
-		pixbuf = cra_font_get_pixbuf (ft_face, 640, 48, tmp, error);
-		if (pixbuf == NULL)
-			return FALSE;
-	}
+	pixbuf = cra_font_get_pixbuf_cached (file, app, 640, 48, tmp, error);
+	if (pixbuf == NULL)
+		return FALSE;
 
 	/* check pixbuf is not just blank */
 	if (cra_font_is_pixbuf_empty (pixbuf)) {
@@ -448,47 +1143,146 @@ cra_font_add_screenshot (CraApp *app, FT_Face ft_face, GError **error)
 	if (caption != NULL)
 		as_screenshot_set_caption (ss, NULL, caption, -1);
 	as_app_add_screenshot (AS_APP (app), ss);
-
-	/* save to cache */
-	if (!g_file_test (cache_fn, G_FILE_TEST_EXISTS)) {
-		if (!gdk_pixbuf_save (pixbuf, cache_fn, "png", error, NULL))
-			return FALSE;
-	}
 	return TRUE;
 }
 
 /**
- * cra_font_add_languages:
+ * cra_font_get_langs:
+ *
+ * Returns all the languages fontconfig knows the orthography of.
  */
-static void
-cra_font_add_languages (CraApp *app, const FcPattern *pattern)
+static const gchar * const *
+cra_font_get_langs (void)
 {
+	static gchar **langs = NULL;
 	const gchar *tmp;
-	FcResult fc_rc = FcResultMatch;
 	FcStrList *list;
-	FcStrSet *langs;
-	FcValue fc_value;
+	FcStrSet *set;
+	GPtrArray *array;
+
+	if (g_once_init_enter (&langs)) {
+		array = g_ptr_array_new ();
+		set = FcGetLangs ();
+		list = FcStrListCreate (set);
+		FcStrListFirst (list);
+		while ((tmp = (const gchar*) FcStrListNext (list)) != NULL)
+			g_ptr_array_add (array, g_strdup (tmp));
+		FcStrListDone (list);
+		FcStrSetDestroy (set);
+		g_ptr_array_add (array, NULL);
+		g_once_init_leave (&langs, (gchar **) g_ptr_array_free (array, FALSE));
+	}
+	return (const gchar * const *) langs;
+}
+
+/**
+ * cra_sfnt_get_exclusive_lang:
+ *
+ * Returns the one CJK language the OS/2 code page bits say the font is
+ * for, which is how fontconfig stops a Han font claiming the others.
+ */
+static const gchar *
+cra_sfnt_get_exclusive_lang (const guint8 *data, gsize len)
+{
+	const gchar *lang = NULL;
+	const guint8 *os2;
+	gsize os2_len;
+	guint16 version;
+	guint32 code_pages;
+	guint i;
+	struct {
+		guint		 bit;
+		const gchar	*lang;
+	} code_page_langs[] = {
+		{ 17,	"ja" },
+		{ 18,	"zh-cn" },
+		{ 19,	"ko" },
+		{ 20,	"zh-tw" },
+		{ 21,	"ko" },
+		{ 0, NULL } };
+
+	if (!cra_sfnt_get_table (data, len, "OS/2", &os2, &os2_len))
+		return NULL;
+	if (os2_len < 82)
+		return NULL;
+	version = cra_sfnt_read16 (os2);
+	if (version < 1 || version == 0xffff)
+		return NULL;
+
+	/* more than one language means none of them are exclusive, but
+	 * two bits can be for the same language */
+	code_pages = cra_sfnt_read32 (os2 + 78);
+	for (i = 0; code_page_langs[i].lang != NULL; i++) {
+		if ((code_pages & (1u << code_page_langs[i].bit)) == 0)
+			continue;
+		if (lang != NULL && g_strcmp0 (lang, code_page_langs[i].lang) != 0)
+			return NULL;
+		lang = code_page_langs[i].lang;
+	}
+	return lang;
+}
+
+/**
+ * cra_font_is_exclusive_lang:
+ */
+static gboolean
+cra_font_is_exclusive_lang (const gchar *lang)
+{
+	return g_strcmp0 (lang, "ja") == 0 ||
+	       g_strcmp0 (lang, "zh-cn") == 0 ||
+	       g_strcmp0 (lang, "ko") == 0 ||
+	       g_strcmp0 (lang, "zh-tw") == 0;
+}
+
+/**
+ * cra_font_add_languages:
+ *
+ * Adds every language whose orthography is covered by the cmap. Like
+ * fontconfig, a font whose code pages name a single CJK language does not
+ * also get the other CJK languages, even if it covers them. Only the
+ * Unicode and symbol cmap subtables are read, so a font with nothing but a
+ * legacy Mac cmap falls back to 'en' where fontconfig may have found more.
+ */
+static gboolean
+cra_font_add_languages (CraApp *app, const guint8 *data, gsize len, GError **error)
+{
+	const gchar * const *langs;
+	const FcCharSet *exclusive_charset = NULL;
+	const FcCharSet *lang_charset;
+	const gchar *exclusive_lang;
+	FcCharSet *charset;
 	guint i;
 	gboolean any_added = FALSE;
 
-	for (i = 0; fc_rc == FcResultMatch; i++) {
-		fc_rc = FcPatternGet (pattern, FC_LANG, i, &fc_value);
-		if (fc_rc == FcResultMatch) {
-			langs = FcLangSetGetLangs (fc_value.u.l);
-			list = FcStrListCreate (langs);
-			FcStrListFirst (list);
-			while ((tmp = (const gchar*) FcStrListNext (list)) != NULL) {
-				as_app_add_language (AS_APP (app), 0, tmp, -1);
-				any_added = TRUE;
-			}
-			FcStrListDone (list);
-			FcStrSetDestroy (langs);
+	if (!cra_sfnt_get_charset (data, len, &charset,
+				   cra_package_get_cancellable (cra_app_get_package (app)),
+				   error))
+		return FALSE;
+	if (charset != NULL) {
+		exclusive_lang = cra_sfnt_get_exclusive_lang (data, len);
+		if (exclusive_lang != NULL)
+			exclusive_charset = FcLangGetCharSet ((const FcChar8 *) exclusive_lang);
+		langs = cra_font_get_langs ();
+		for (i = 0; langs[i] != NULL; i++) {
+			lang_charset = FcLangGetCharSet ((const FcChar8 *) langs[i]);
+			if (lang_charset == NULL)
+				continue;
+			if (exclusive_charset != NULL &&
+			    cra_font_is_exclusive_lang (langs[i]) &&
+			    !FcCharSetEqual (lang_charset, exclusive_charset))
+				continue;
+			if (!FcCharSetIsSubset (lang_charset, charset))
+				continue;
+			as_app_add_language (AS_APP (app), 0, langs[i], -1);
+			any_added = TRUE;
 		}
+		FcCharSetDestroy (charset);
 	}
 
 	/* assume 'en' is available */
 	if (!any_added)
 		as_app_add_language (AS_APP (app), 0, "en", -1);
+	return TRUE;
 }
 
 /**
@@ -538,53 +1332,62 @@ cra_plugin_process_filename (CraPlugin *plugin,
 			     const gchar *tmpdir,
 			     GError **error)
 {
-	FcConfig *config;
-	FcFontSet *fonts;
-	FT_Error rc;
-	FT_Face ft_face = NULL;
-	FT_Library library = NULL;
+	CraFontFile file;
 	const gchar *tmp;
+	const guint8 *names;
 	gboolean ret = TRUE;
-	const FcPattern *pattern;
+	gboolean wws;
+	gsize names_len;
+	const guint16 family_ids[] = { 21, 16, 1, 0 };
+	const guint16 style_ids[] = { 22, 17, 2, 0 };
 	_cleanup_free_ gchar *app_id = NULL;
 	_cleanup_free_ gchar *comment = NULL;
+	_cleanup_free_ gchar *family = NULL;
 	_cleanup_free_ gchar *filename_full;
 	_cleanup_free_ gchar *icon_filename = NULL;
+	_cleanup_free_ gchar *style = NULL;
 	_cleanup_object_unref_ CraApp *app = NULL;
 	_cleanup_object_unref_ GdkPixbuf *pixbuf = NULL;
 
-	/* load font */
+	/* load font, which is only opened in FreeType if it is drawn */
+	memset (&file, 0, sizeof (file));
+	file.plugin = plugin;
 	filename_full = g_build_filename (tmpdir, filename, NULL);
-	config = FcConfigCreate ();
-	ret = FcConfigAppFontAddFile (config, (FcChar8 *) filename_full);
-	if (!ret) {
-		g_set_error (error,
-			     CRA_PLUGIN_ERROR,
-			     CRA_PLUGIN_ERROR_FAILED,
-			     "Failed to AddFile %s", filename);
+	file.mapped = g_mapped_file_new (filename_full, FALSE, error);
+	if (file.mapped == NULL) {
+		ret = FALSE;
 		goto out;
 	}
-	fonts = FcConfigGetFonts (config, FcSetApplication);
-	if (fonts == NULL || fonts->fonts == NULL) {
+	file.data = (const guint8 *) g_mapped_file_get_contents (file.mapped);
+	file.len = g_mapped_file_get_length (file.mapped);
+	file.digest = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+						   file.data, file.len);
+	if (!cra_sfnt_get_table (file.data, file.len, "name", &names, &names_len)) {
 		ret = FALSE;
-		g_set_error_literal (error,
-				     CRA_PLUGIN_ERROR,
-				     CRA_PLUGIN_ERROR_FAILED,
-				     "FcConfigGetFonts failed");
+		g_set_error (error,
+			     CRA_PLUGIN_ERROR,
+			     CRA_PLUGIN_ERROR_FAILED,
+			     "Failed to read the name table from %s",
+			     filename);
 		goto out;
 	}
-	pattern = fonts->fonts[0];
-	FT_Init_FreeType (&library);
-	rc = FT_New_Face (library, filename_full, 0, &ft_face);
-	if (rc != 0) {
+
+	/* use the same family and style FreeType would */
+	wws = cra_sfnt_has_wws_names (file.data, file.len);
+	family = cra_sfnt_get_first_name (names, names_len,
+					  wws ? family_ids : family_ids + 1);
+	if (family == NULL) {
 		ret = FALSE;
 		g_set_error (error,
 			     CRA_PLUGIN_ERROR,
 			     CRA_PLUGIN_ERROR_FAILED,
-			     "FT_Open_Face failed to open %s: %i",
-			     filename, rc);
+			     "No family name in %s", filename);
 		goto out;
 	}
+	style = cra_sfnt_get_first_name (names, names_len,
+					 wws ? style_ids : style_ids + 1);
+	if (style == NULL)
+		style = g_strdup ("Regular");
 
 	/* create app that might get merged later */
 	app_id = g_path_get_basename (filename);
@@ -593,15 +1396,15 @@ cra_plugin_process_filename (CraPlugin *plugin,
 	as_app_add_category (AS_APP (app), "Addons", -1);
 	as_app_add_category (AS_APP (app), "Fonts", -1);
 	cra_app_set_requires_appdata (app, TRUE);
-	cra_plugin_font_set_name (app, ft_face->family_name);
-	comment = g_strdup_printf ("A %s font from %s",
-				   ft_face->style_name,
-				   ft_face->family_name);
+	cra_plugin_font_set_name (app, family);
+	comment = g_strdup_printf ("A %s font from %s", style, family);
 	as_app_set_comment (AS_APP (app), "C", comment, -1);
-	cra_font_add_languages (app, pattern);
-	cra_font_add_metadata (app, ft_face);
+	ret = cra_font_add_languages (app, file.data, file.len, error);
+	if (!ret)
+		goto out;
+	cra_font_add_metadata (app, names, names_len);
 	cra_font_fix_metadata (app);
-	ret = cra_font_add_screenshot (app, ft_face, error);
+	ret = cra_font_add_screenshot (app, &file, error);
 	if (!ret)
 		goto out;
 
@@ -610,7 +1413,7 @@ cra_plugin_process_filename (CraPlugin *plugin,
 	if (tmp != NULL) {
 		icon_filename = g_strdup_printf ("%s.png", as_app_get_id (AS_APP (app)));
 		as_app_set_icon (AS_APP (app), icon_filename, -1);
-		pixbuf = cra_font_get_pixbuf (ft_face, 64, 64, tmp, error);
+		pixbuf = cra_font_get_pixbuf_cached (&file, app, 64, 64, tmp, error);
 		if (pixbuf == NULL) {
 			ret = FALSE;
 			goto out;
@@ -633,15 +1436,30 @@ cra_plugin_process_filename (CraPlugin *plugin,
 	/* add */
 	cra_plugin_add_app (apps, app);
 out:
-	FcConfigAppFontClear (config);
-	FcConfigDestroy (config);
-	if (ft_face != NULL)
-		FT_Done_Face (ft_face);
-	if (library != NULL)
-		FT_Done_Library (library);
+	cra_font_file_clear (&file);
 	return ret;
 }
 
+/**
+ * cra_plugin_process_file:
+ */
+gboolean
+cra_plugin_process_file (CraPlugin *plugin,
+			 CraPackage *pkg,
+			 const gchar *filename,
+			 GList **apps,
+			 const gchar *tmpdir,
+			 GError **error)
+{
+	/* any bad font fails the whole package */
+	return cra_plugin_process_filename (plugin,
+					    pkg,
+					    filename,
+					    apps,
+					    tmpdir,
+					    error);
+}
+
 /**
  * cra_plugin_process:
  */
@@ -684,115 +1502,187 @@ cra_plugin_process (CraPlugin *plugin,
 	return apps;
 }
 
+/* substrings that make a font a worse choice to represent its family */
+static const gchar *cra_font_sortable_patterns[] = {
+	"It", "Bold", "Semibold", "ExtraLight", "Lig", "Medium", "Bla", "Hai",
+	"Keyboard", "Kufi", "Tamil", "Hebrew", "Arabic", "Fallback", NULL };
+
 /**
  * cra_font_get_app_sortable_idx:
+ *
+ * Returns how many of the patterns are in the app ID, scanning it once and
+ * only comparing the patterns that start with each character.
  */
 static guint
 cra_font_get_app_sortable_idx (CraApp *app)
 {
+	static gsize first_char_set = 0;
+	static guint16 first_char[256];
 	const gchar *font_str = as_app_get_id (AS_APP (app));
+	guint16 found = 0;
+	guint16 mask;
+	guint i;
 	guint idx = 0;
+	guint j;
 
-	if (g_strstr_len (font_str, -1, "It") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Bold") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Semibold") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "ExtraLight") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Lig") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Medium") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Bla") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Hai") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Keyboard") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Kufi") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Tamil") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Hebrew") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Arabic") != NULL)
-		idx += 1;
-	if (g_strstr_len (font_str, -1, "Fallback") != NULL)
-		idx += 1;
+	if (g_once_init_enter (&first_char_set)) {
+		for (j = 0; cra_font_sortable_patterns[j] != NULL; j++)
+			first_char[(guchar) cra_font_sortable_patterns[j][0]] |= 1 << j;
+		g_once_init_leave (&first_char_set, 1);
+	}
+
+	for (i = 0; font_str[i] != '\0'; i++) {
+		mask = first_char[(guchar) font_str[i]] & ~found;
+		for (j = 0; mask != 0; j++, mask >>= 1) {
+			if ((mask & 1) == 0)
+				continue;
+			if (g_str_has_prefix (font_str + i, cra_font_sortable_patterns[j]))
+				found |= 1 << j;
+		}
+	}
+	for (; found != 0; found >>= 1)
+		idx += found & 1;
+	return idx;
+}
+
+/**
+ * cra_font_get_app_sortable_idx_cached:
+ */
+static guint
+cra_font_get_app_sortable_idx_cached (GHashTable *sortable_idxs, CraApp *app)
+{
+	gpointer value;
+	guint idx;
+
+	if (g_hash_table_lookup_extended (sortable_idxs, app, NULL, &value))
+		return GPOINTER_TO_UINT (value);
+	idx = cra_font_get_app_sortable_idx (app);
+	g_hash_table_insert (sortable_idxs, app, GUINT_TO_POINTER (idx));
 	return idx;
 }
 
 /**
  * cra_font_merge_family:
+ *
+ * Merges each family in @index into its best font, skipping the fonts that
+ * were already merged using another key.
  */
 static void
-cra_font_merge_family (GList **list, const gchar *md_key)
+cra_font_merge_family (GHashTable *index,
+		       GHashTable *sortable_idxs,
+		       GHashTable *merged_set,
+		       GPtrArray *merged)
 {
 	CraApp *app;
 	CraApp *found;
-	GList *hash_values = NULL;
-	GList *l;
-	GList *list_new = NULL;
-	const gchar *tmp;
-	_cleanup_hashtable_unref_ GHashTable *hash;
+	GHashTableIter iter;
+	GPtrArray *family;
+	gpointer value;
+	guint found_idx = 0;
+	guint i;
+	guint idx;
 
-	hash = g_hash_table_new_full (g_str_hash, g_str_equal,
-				      g_free, (GDestroyNotify) g_object_unref);
-	for (l = *list; l != NULL; l = l->next) {
-		if (!CRA_IS_APP (l->data)) {
-			cra_plugin_add_app (&list_new, l->data);
+	g_hash_table_iter_init (&iter, index);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		family = value;
+		if (family->len < 2)
 			continue;
-		}
-		app = CRA_APP (l->data);
 
-		/* no family, or not a font */
-		tmp = as_app_get_metadata_item (AS_APP (app), md_key);
-		if (tmp == NULL) {
-			cra_plugin_add_app (&list_new, app);
-			continue;
-		}
+		/* find the best font in the family */
+		found = NULL;
+		for (i = 0; i < family->len; i++) {
+			app = g_ptr_array_index (family, i);
+			if (!CRA_IS_APP (app))
+				continue;
+			if (g_hash_table_contains (merged_set, app))
+				continue;
+			idx = cra_font_get_app_sortable_idx_cached (sortable_idxs, app);
+			if (found == NULL) {
+				found = app;
+				found_idx = idx;
+				continue;
+			}
 
-		/* find the font family */
-		found = g_hash_table_lookup (hash, tmp);
-		if (found == NULL) {
-			g_hash_table_insert (hash,
-					     g_strdup (tmp),
-					     g_object_ref (app));
-		} else {
 			/* app is better than found */
-			if (cra_font_get_app_sortable_idx (app) <
-			    cra_font_get_app_sortable_idx (found)) {
-				g_hash_table_insert (hash,
-						     g_strdup (tmp),
-						     g_object_ref (app));
+			if (idx < found_idx) {
 				as_app_subsume (AS_APP (app), AS_APP (found));
+				g_hash_table_add (merged_set, found);
+				g_ptr_array_add (merged, g_object_ref (found));
+				found = app;
+				found_idx = idx;
 			} else {
 				as_app_subsume (AS_APP (found), AS_APP (app));
+				g_hash_table_add (merged_set, app);
+				g_ptr_array_add (merged, g_object_ref (app));
 			}
 		}
 	}
+}
 
-	/* add all the best fonts to the list */
-	hash_values = g_hash_table_get_values (hash);
-	for (l = hash_values; l != NULL; l = l->next) {
-		app = CRA_APP (l->data);
-		cra_plugin_add_app (&list_new, app);
-	}
-	g_list_free (hash_values);
+/**
+ * cra_font_get_parent_index:
+ *
+ * Groups the fonts that are left by FontParent, as it is after the families
+ * were merged, in the same way as cra_store_get_metadata_index().
+ */
+static GHashTable *
+cra_font_get_parent_index (CraStore *store, GHashTable *merged_set)
+{
+	AsApp *app;
+	GHashTable *index;
+	GPtrArray *apps;
+	GPtrArray *array;
+	const gchar *value;
+	guint i;
 
-	/* success */
-	g_list_free_full (*list, (GDestroyNotify) g_object_unref);
-	*list = list_new;
+	index = g_hash_table_new_full (g_str_hash, g_str_equal,
+				       g_free, (GDestroyNotify) g_ptr_array_unref);
+	apps = cra_store_get_apps (store);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+		if (app == NULL || !CRA_IS_APP (app))
+			continue;
+		if (g_hash_table_contains (merged_set, app))
+			continue;
+		value = as_app_get_metadata_item (app, "FontParent");
+		if (value == NULL)
+			continue;
+		array = g_hash_table_lookup (index, value);
+		if (array == NULL) {
+			array = g_ptr_array_new ();
+			g_hash_table_insert (index, g_strdup (value), array);
+		}
+		g_ptr_array_add (array, app);
+	}
+	return index;
 }
 
 /**
  * cra_plugin_merge:
  */
 void
-cra_plugin_merge (CraPlugin *plugin, GList **list)
+cra_plugin_merge (CraPlugin *plugin, CraStore *store)
 {
-	cra_font_merge_family (list, "FontFamily");
-	cra_font_merge_family (list, "FontParent");
+	CraApp *app;
+	guint i;
+	_cleanup_hashtable_unref_ GHashTable *merged_set = NULL;
+	_cleanup_hashtable_unref_ GHashTable *parent_index = NULL;
+	_cleanup_hashtable_unref_ GHashTable *sortable_idxs = NULL;
+	_cleanup_ptrarray_unref_ GPtrArray *merged = NULL;
+
+	/* nothing is removed until the end, so the store is only indexed once
+	 * and the parents are looked up after the families are subsumed */
+	merged = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	merged_set = g_hash_table_new (g_direct_hash, g_direct_equal);
+	sortable_idxs = g_hash_table_new (g_direct_hash, g_direct_equal);
+	cra_font_merge_family (cra_store_get_metadata_index (store, "FontFamily"),
+			       sortable_idxs, merged_set, merged);
+	parent_index = cra_font_get_parent_index (store, merged_set);
+	cra_font_merge_family (parent_index, sortable_idxs, merged_set, merged);
+
+	/* remove the fonts that were merged into another */
+	for (i = 0; i < merged->len; i++) {
+		app = g_ptr_array_index (merged, i);
+		cra_store_remove_app (store, AS_APP (app));
+	}
 }
@@ -232,19 +232,23 @@ cra_plugin_process_app (CraPlugin *plugin,
 	/* look for ancient toolkits */
 	for (i = 0; deps != NULL && deps[i] != NULL; i++) {
 		if (g_strcmp0 (deps[i], "libgtk-1.2.so.0") == 0) {
-			cra_app_add_veto (app, "Uses obsolete GTK1 toolkit");
+			cra_app_add_veto (app, "obsolete-toolkit",
+					  "Uses obsolete GTK1 toolkit");
 			break;
 		}
 		if (g_strcmp0 (deps[i], "libqt-mt.so.3") == 0) {
-			cra_app_add_veto (app, "Uses obsolete QT3 toolkit");
+			cra_app_add_veto (app, "obsolete-toolkit",
+					  "Uses obsolete QT3 toolkit");
 			break;
 		}
 		if (g_strcmp0 (deps[i], "liblcms.so.1") == 0) {
-			cra_app_add_veto (app, "Uses obsolete LCMS library");
+			cra_app_add_veto (app, "obsolete-library",
+					  "Uses obsolete LCMS library");
 			break;
 		}
 		if (g_strcmp0 (deps[i], "libelektra.so.4") == 0) {
-			cra_app_add_veto (app, "Uses obsolete Elektra library");
+			cra_app_add_veto (app, "obsolete-library",
+					  "Uses obsolete Elektra library");
 			break;
 		}
 		if (g_strcmp0 (deps[i], "libXt.so.6") == 0) {
@@ -281,7 +285,8 @@ cra_plugin_process_app (CraPlugin *plugin,
 
 		/* this is just too old for us to care about */
 		if (days > 365 * 10) {
-			cra_app_add_veto (app, "Dead upstream for %i years",
+			cra_app_add_veto (app, "dead-upstream",
+					  "Dead upstream for %i years",
 					  secs / (60 * 60 * 24 * 365));
 		}
 